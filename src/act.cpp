@@ -0,0 +1,399 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "act.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+	// more than any board reports
+	const unsigned int	MAX_CLOCKS = 512;
+
+	// the real limits of the board, when available
+	void get_hw_limits(const nvml::nvmlDevice_t dev, unsigned int& hw_min, unsigned int& hw_max) {
+		unsigned int	min = 0,
+				max = 0;
+		if(nvml::nvmlDeviceGetPowerManagementLimitConstraints && !nvml::nvmlDeviceGetPowerManagementLimitConstraints(dev, &min, &max) && min <= max) {
+			hw_min = min;
+			hw_max = max;
+		}
+	}
+}
+
+act::actuator::actuator(const unsigned int default_limit, const unsigned int min_write_ms) :
+	default_(default_limit), min_write_ms_(min_write_ms), hw_min_(ctrl::MIN_PWR_LIMIT), hw_max_(default_limit),
+	tgt_(default_limit), written_(default_limit), since_write_ms_(min_write_ms), pending_(false), mbox_(0), mbox_full_(false), stop_(false), gave_up_(false) {
+	st_.issued = st_.suppressed = st_.deferred = st_.dropped = st_.failed = 0;
+}
+
+act::actuator::~actuator() {
+	stop();
+}
+
+void act::actuator::init(const unsigned int min_limit_pct) {
+	// we never go above the default limit
+	max_ = top_ = (default_ < hw_max_) ? default_ : hw_max_;
+	set_min(min_limit_pct);
+	tgt_ = max_;
+}
+
+void act::actuator::set_min(const unsigned int min_limit_pct) {
+	min_ = min_limit_pct * default_ / 100;
+	if(min_ < hw_min_)
+		min_ = hw_min_;
+	if(min_ > top_)
+		min_ = top_;
+	if(max_ < min_)
+		max_ = min_;
+}
+
+void act::actuator::write(void) {
+	std::unique_lock<std::mutex>	l(mtx_);
+	// nothing to do if the limit in place
+	// is already the target
+	if(tgt_ == written_) {
+		++st_.suppressed;
+		pending_ = false;
+		return;
+	}
+	if(since_write_ms_ < min_write_ms_) {
+		if(!pending_)
+			++st_.deferred;
+		pending_ = true;
+		return;
+	}
+	if(th_.joinable()) {
+		// a target not yet picked up by the
+		// writer thread is stale by now
+		if(mbox_full_)
+			++st_.dropped;
+		mbox_ = tgt_;
+		mbox_full_ = true;
+		written_ = tgt_;
+		pending_ = false;
+		since_write_ms_ = 0;
+		l.unlock();
+		cv_.notify_one();
+		return;
+	}
+	l.unlock();
+	// different targets can map to the same
+	// setting of the device
+	const bool	issued = write_hw(tgt_);
+	l.lock();
+	written_ = tgt_;
+	pending_ = false;
+	if(!issued) {
+		++st_.suppressed;
+		return;
+	}
+	since_write_ms_ = 0;
+	++st_.issued;
+}
+
+void act::actuator::loop(void) {
+	lat::cur = &lat_;
+	unsigned int			retry_ms = 0,
+					fails = 0;
+	std::unique_lock<std::mutex>	l(mtx_);
+	while(true) {
+		// after a failure wait before retrying,
+		// whatever the target by then
+		if(retry_ms)
+			cv_.wait_for(l, std::chrono::milliseconds(retry_ms), [this](){ return stop_; });
+		else
+			cv_.wait(l, [this](){ return stop_ || mbox_full_; });
+		if(stop_)
+			break;
+		const unsigned int	tgt = mbox_;
+		mbox_full_ = false;
+		l.unlock();
+		bool		issued = false,
+				permanent = false;
+		std::string	error;
+		try {
+			issued = write_hw(tgt);
+		} catch(const nvml::error& e) {
+			error = e.what();
+			permanent = e.permanent();
+		} catch(const std::exception& e) {
+			error = e.what();
+		} catch(...) {
+			error = "Unknown exception";
+		}
+		l.lock();
+		if(!error.empty()) {
+			++st_.failed;
+			error_ = error;
+			if(permanent || ++fails >= MAX_FAILS) {
+				gave_up_ = true;
+				break;
+			}
+			// unless a newer target came meanwhile
+			if(!mbox_full_) {
+				mbox_ = tgt;
+				mbox_full_ = true;
+			}
+			retry_ms = retry_ms ? std::min(2*retry_ms, RETRY_MAX_MS) : RETRY_MIN_MS;
+			continue;
+		}
+		retry_ms = fails = 0;
+		if(issued)
+			++st_.issued;
+		else
+			++st_.suppressed;
+	}
+	lat::cur = 0;
+}
+
+void act::actuator::start(void) {
+	if(th_.joinable())
+		return;
+	stop_ = gave_up_ = false;
+	th_ = std::thread(&actuator::loop, this);
+}
+
+void act::actuator::stop(void) {
+	{
+		std::lock_guard<std::mutex>	l(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+	if(th_.joinable())
+		th_.join();
+	mbox_full_ = false;
+}
+
+bool act::actuator::restore(void) {
+	stop();
+	// not to leave the GPU with a low limit
+	// because of a transient failure
+	for(unsigned int i = 1, retry_ms = RETRY_MIN_MS; ; ++i, retry_ms *= 2) {
+		try {
+			return restore_hw();
+		} catch(...) {
+			if(i >= RESTORE_TRIES)
+				throw;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(retry_ms));
+	}
+}
+
+void act::actuator::apply(const ctrl::action a, const float bump_factor, const unsigned int elapsed_ms) {
+	since_write_ms_ += elapsed_ms;
+	if(a == ctrl::action::PWR_CNST) {
+		// previously deferred write
+		if(pending_)
+			write();
+		return;
+	}
+	tgt_ = ctrl::apply_action(a, bump_factor, tgt_, min_, max_);
+	write();
+}
+
+unsigned int act::actuator::set(const unsigned int limit) {
+	tgt_ = limit;
+	if(tgt_ > hw_max_)
+		tgt_ = hw_max_;
+	if(tgt_ < hw_min_)
+		tgt_ = hw_min_;
+	since_write_ms_ = min_write_ms_;
+	write();
+	return tgt_;
+}
+
+void act::actuator::set_min_limit_pct(const unsigned int min_limit_pct) {
+	set_min(min_limit_pct);
+	if(tgt_ < min_) {
+		tgt_ = min_;
+		write();
+	}
+}
+
+void act::actuator::set_max_limit(const unsigned int limit) {
+	// a target held at the max limit follows it
+	// up, it wasn't the throttle holding it back
+	const bool	at_max = tgt_ >= max_;
+	max_ = (limit < top_) ? limit : top_;
+	if(max_ < min_)
+		max_ = min_;
+	if(tgt_ > max_ || (at_max && tgt_ != max_)) {
+		tgt_ = max_;
+		write();
+	}
+}
+
+act::pwr_limit::pwr_limit(const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms) :
+	actuator(default_limit, min_write_ms), dev_(dev) {
+	if(dev_) {
+		// else never go below the hard min pwr limit
+		get_hw_limits(dev_, hw_min_, hw_max_);
+		// start from the limit currently set
+		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementLimit(dev_, &written_));
+	}
+	init(min_limit_pct);
+}
+
+bool act::pwr_limit::write_hw(const unsigned int tgt) {
+	if(dev_)
+		SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev_, tgt));
+	return true;
+}
+
+bool act::pwr_limit::restore_hw(void) {
+	tgt_ = default_;
+	if(dev_) {
+		// before quitting, restore original power limits
+		// only if those got changed
+		unsigned int	cur_pwr_limit = 0;
+		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementLimit(dev_, &cur_pwr_limit));
+		if(cur_pwr_limit == default_)
+			return false;
+		SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev_, default_));
+	}
+	written_ = default_;
+	return true;
+}
+
+act::clk_lock::clk_lock(const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms) :
+	actuator(default_limit, min_write_ms), dev_(dev), locked_(0) {
+	if(!nvml::nvmlDeviceSetGpuLockedClocks || !nvml::nvmlDeviceResetGpuLockedClocks || !nvml::nvmlDeviceGetSupportedMemoryClocks || !nvml::nvmlDeviceGetSupportedGraphicsClocks)
+		throw std::runtime_error("NVML doesn't support locking clocks, can't use the clocks actuator");
+	// graphics clocks are reported per memory clock,
+	// take the ones at the highest
+	std::vector<unsigned int>	mem_clocks(MAX_CLOCKS);
+	unsigned int			n = MAX_CLOCKS;
+	SAFE_NVML_CALL(nvml::nvmlDeviceGetSupportedMemoryClocks(dev_, &n, &mem_clocks[0]));
+	mem_clocks.resize(n);
+	if(mem_clocks.empty())
+		throw std::runtime_error("No supported memory clocks, can't use the clocks actuator");
+	n = MAX_CLOCKS;
+	clocks_.resize(n);
+	SAFE_NVML_CALL(nvml::nvmlDeviceGetSupportedGraphicsClocks(dev_, *std::max_element(mem_clocks.begin(), mem_clocks.end()), &n, &clocks_[0]));
+	clocks_.resize(n);
+	std::sort(clocks_.begin(), clocks_.end());
+	clocks_.erase(std::unique(clocks_.begin(), clocks_.end()), clocks_.end());
+	if(clocks_.empty())
+		throw std::runtime_error("No supported graphics clocks, can't use the clocks actuator");
+	get_hw_limits(dev_, hw_min_, hw_max_);
+	init(min_limit_pct);
+	// clocks are unlocked, i.e. at the top limit
+	written_ = top_;
+}
+
+unsigned int act::clk_lock::clock_for(const unsigned int tgt) const {
+	if(tgt >= top_)
+		return clocks_.back();
+	// the min limit the board accepts is about what it
+	// draws at the lowest clocks, the rest scales with
+	// the cube of the clock
+	const double	clk = (tgt > hw_min_ && top_ > hw_min_) ? clocks_.back()*std::cbrt(1.0*(tgt - hw_min_)/(top_ - hw_min_)) : 0.0;
+	// highest supported clock not above it
+	auto		it = std::upper_bound(clocks_.begin(), clocks_.end(), clk, [](const double c, const unsigned int v) { return c < v; });
+	return (it == clocks_.begin()) ? clocks_.front() : *(it - 1);
+}
+
+bool act::clk_lock::write_hw(const unsigned int tgt) {
+	if(tgt >= top_) {
+		if(!locked_)
+			return false;
+		SAFE_NVML_CALL(nvml::nvmlDeviceResetGpuLockedClocks(dev_));
+		locked_ = 0;
+		return true;
+	}
+	const unsigned int	clk = clock_for(tgt);
+	if(clk == locked_)
+		return false;
+	SAFE_NVML_CALL(nvml::nvmlDeviceSetGpuLockedClocks(dev_, clocks_.front(), clk));
+	locked_ = clk;
+	return true;
+}
+
+bool act::clk_lock::restore_hw(void) {
+	tgt_ = written_ = top_;
+	if(!locked_)
+		return false;
+	SAFE_NVML_CALL(nvml::nvmlDeviceResetGpuLockedClocks(dev_));
+	locked_ = 0;
+	return true;
+}
+
+act::fan_duty::fan_duty(const nvml::nvmlDevice_t dev, const unsigned int min_write_ms) : dev_(dev), min_write_ms_(min_write_ms), n_fans_(0), min_(0), max_(100),
+	since_write_ms_(min_write_ms), duty_(-1), writes_(0), failed_(0) {
+	if(!nvml::nvmlDeviceGetNumFans || !nvml::nvmlDeviceSetFanSpeed_v2 || !nvml::nvmlDeviceSetDefaultFanSpeed_v2)
+		throw std::runtime_error("NVML doesn't support setting fan speeds");
+	SAFE_NVML_CALL(nvml::nvmlDeviceGetNumFans(dev_, &n_fans_));
+	if(!n_fans_)
+		throw std::runtime_error("No fans to drive");
+	// else any duty is assumed valid
+	unsigned int	min = 0,
+			max = 0;
+	if(nvml::nvmlDeviceGetMinMaxFanSpeed && !nvml::nvmlDeviceGetMinMaxFanSpeed(dev_, &min, &max) && min <= max && max) {
+		min_ = min;
+		max_ = max;
+	}
+}
+
+void act::fan_duty::set(const unsigned int pct, const unsigned int elapsed_ms) {
+	since_write_ms_ += elapsed_ms;
+	const int	tgt = (pct < min_) ? min_ : (pct > max_) ? max_ : pct;
+	if(tgt == duty_ || since_write_ms_ < min_write_ms_)
+		return;
+	since_write_ms_ = 0;
+	try {
+		for(unsigned int i = 0; i < n_fans_; ++i)
+			SAFE_NVML_CALL(nvml::nvmlDeviceSetFanSpeed_v2(dev_, i, tgt));
+	} catch(const std::exception& e) {
+		++failed_;
+		error_ = e.what();
+		return;
+	}
+	duty_ = tgt;
+	++writes_;
+}
+
+void act::fan_duty::release(const unsigned int elapsed_ms) {
+	since_write_ms_ += elapsed_ms;
+	if(duty_ < 0 || since_write_ms_ < min_write_ms_)
+		return;
+	since_write_ms_ = 0;
+	try {
+		restore();
+	} catch(const std::exception& e) {
+		++failed_;
+		error_ = e.what();
+	}
+}
+
+bool act::fan_duty::restore(void) {
+	if(duty_ < 0)
+		return false;
+	for(unsigned int i = 0; i < n_fans_; ++i)
+		SAFE_NVML_CALL(nvml::nvmlDeviceSetDefaultFanSpeed_v2(dev_, i));
+	duty_ = -1;
+	return true;
+}
+
+act::actuator* act::get_actuator(const std::string& name, const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms) {
+	if(name == "power")
+		return new pwr_limit(dev, default_limit, min_limit_pct, min_write_ms);
+	if(name == "clocks")
+		return new clk_lock(dev, default_limit, min_limit_pct, min_write_ms);
+	throw std::runtime_error((std::string("Invalid actuator '") + name + "'").c_str());
+}
@@ -0,0 +1,294 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _ACT_H_
+#define _ACT_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ctrl.h"
+#include "nvml.h"
+
+namespace act {
+	struct stats {
+		size_t	issued,
+			suppressed,
+			deferred,
+			// with the writer thread only
+			dropped,
+			failed;
+	};
+
+	// writes failing on the writer thread are retried,
+	// waiting twice as long each time up to the max, and
+	// given up after MAX_FAILS in a row or on errors
+	// retrying won't fix
+	const unsigned int	RETRY_MIN_MS = 100,
+				RETRY_MAX_MS = 5000,
+				MAX_FAILS = 10,
+				RESTORE_TRIES = 3;
+
+	// owns the limit of a device: clamps the targets to
+	// the limits the board accepts, skips writes which
+	// wouldn't change the limit in place and rate limits
+	// the writes (the latest target gets written as soon
+	// as allowed). Targets are in mW for any actuator, so
+	// that the throttles don't depend on it.
+	// Once started, writes happen on a dedicated thread
+	// fed by a single slot mailbox: the latest target
+	// replaces any not yet written, a slow write never
+	// delays the caller and failed writes are retried
+	// instead of throwing
+	class actuator {
+	protected:
+		const unsigned int		default_,
+		      				min_write_ms_;
+		unsigned int			hw_min_,
+						hw_max_,
+						top_,
+						min_,
+						max_,
+						tgt_,
+						written_,
+						since_write_ms_;
+		bool				pending_;
+		stats				st_;
+		// writer thread, mtx_ guards st_ and
+		// everything below
+		mutable std::mutex		mtx_;
+		std::condition_variable		cv_;
+		std::thread			th_;
+		lat::table			lat_;
+		unsigned int			mbox_;
+		bool				mbox_full_,
+						stop_,
+						gave_up_;
+		std::string			error_;
+
+		void write(void);
+		void loop(void);
+		void set_min(const unsigned int min_limit_pct);
+
+		// to be invoked by the derived constructors, once
+		// hw_min_, hw_max_ and written_ are known
+		void init(const unsigned int min_limit_pct);
+
+		// writes tgt to the device, returns false when the
+		// setting in place already matches it
+		virtual bool write_hw(const unsigned int tgt) = 0;
+
+		// sets back the default setting, returns false
+		// if it was already in place
+		virtual bool restore_hw(void) = 0;
+	public:
+		actuator(const unsigned int default_limit, const unsigned int min_write_ms);
+
+		// restore has to be invoked before, when
+		// started, as the writer thread uses the
+		// derived classes
+		virtual ~actuator();
+
+		virtual const char* name(void) const = 0;
+
+		// applies the throttle action, elapsed_ms is the
+		// time passed since the previous invocation
+		void apply(const ctrl::action a, const float bump_factor, const unsigned int elapsed_ms);
+
+		// sets a fixed limit, returns the clamped one
+		unsigned int set(const unsigned int limit);
+
+		// moves the writes to the writer thread
+		void start(void);
+
+		// joins the writer thread, a target not yet
+		// written is dropped
+		void stop(void);
+
+		// stops the writer thread and sets back the
+		// default setting, if changed; tries a few
+		// times before throwing
+		bool restore(void);
+
+		// changes the min limit, as a percentage of
+		// the default one, raising the target if below
+		void set_min_limit_pct(const unsigned int min_limit_pct);
+
+		// lowers the max limit below the default one (i.e.
+		// a share of a node budget), never below the min
+		// limit; the target is lowered if above, and
+		// follows the max limit up when at it
+		void set_max_limit(const unsigned int limit);
+
+		unsigned int target(void) const {
+			return tgt_;
+		}
+
+		unsigned int min_limit(void) const {
+			return min_;
+		}
+
+		unsigned int max_limit(void) const {
+			return max_;
+		}
+
+		// max limit before any set_max_limit
+		unsigned int top_limit(void) const {
+			return top_;
+		}
+
+		unsigned int hw_min_limit(void) const {
+			return hw_min_;
+		}
+
+		unsigned int hw_max_limit(void) const {
+			return hw_max_;
+		}
+
+		stats get_stats(void) const {
+			std::lock_guard<std::mutex>	l(mtx_);
+			return st_;
+		}
+
+		// error of the latest failed write
+		std::string last_error(void) const {
+			std::lock_guard<std::mutex>	l(mtx_);
+			return error_;
+		}
+
+		// true once the writer thread stopped retrying,
+		// last_error tells why
+		bool gave_up(void) const {
+			std::lock_guard<std::mutex>	l(mtx_);
+			return gave_up_;
+		}
+
+		// timings of the writer thread, null while
+		// it's running
+		const lat::table* latency(void) const {
+			return th_.joinable() ? 0 : &lat_;
+		}
+	};
+
+	// writes the target as the power limit of the board.
+	// When dev is null nothing gets written to the device
+	// (i.e. replay)
+	class pwr_limit : public actuator {
+		const nvml::nvmlDevice_t	dev_;
+	protected:
+		bool write_hw(const unsigned int tgt);
+
+		bool restore_hw(void);
+	public:
+		pwr_limit(const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms);
+
+		const char* name(void) const {
+			return "power";
+		}
+	};
+
+	// locks the max graphics clock instead: the target is
+	// mapped to the supported clock whose dynamic power
+	// (scaling with the cube of the clock) fits it; at the
+	// top limit the clocks get unlocked. Locked clocks
+	// react within a sample, while the power limit is
+	// enforced by the board over a longer window
+	class clk_lock : public actuator {
+		const nvml::nvmlDevice_t	dev_;
+		// ascending
+		std::vector<unsigned int>	clocks_;
+		unsigned int			locked_;
+	protected:
+		bool write_hw(const unsigned int tgt);
+
+		bool restore_hw(void);
+	public:
+		// throws if the device can't lock clocks
+		clk_lock(const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms);
+
+		const char* name(void) const {
+			return "clocks";
+		}
+
+		// the clock target maps to, in MHz
+		unsigned int clock_for(const unsigned int tgt) const;
+
+		// the max clock currently locked, 0 if unlocked
+		unsigned int locked_clock(void) const {
+			return locked_;
+		}
+	};
+
+	// drives the duty of all the fans of a board, which
+	// otherwise follow the firmware fan curve. Writes are
+	// skipped when unchanged and rate limited as the ones
+	// of the limit; a failed write is only counted, the
+	// next set retries it
+	class fan_duty {
+		const nvml::nvmlDevice_t	dev_;
+		const unsigned int		min_write_ms_;
+		unsigned int			n_fans_,
+						min_,
+						max_,
+						since_write_ms_;
+		// -1 when following the firmware
+		int				duty_;
+		size_t				writes_,
+						failed_;
+		std::string			error_;
+	public:
+		// throws if the device can't set fan speeds
+		fan_duty(const nvml::nvmlDevice_t dev, const unsigned int min_write_ms);
+
+		// pct is clamped to what the board accepts,
+		// elapsed_ms is the time since the previous
+		// invocation
+		void set(const unsigned int pct, const unsigned int elapsed_ms);
+
+		// back to the firmware fan curve, if changed
+		bool restore(void);
+
+		// as restore, but rate limited as set and
+		// failures are only counted (i.e. switching
+		// to a throttle leaving the fans alone)
+		void release(const unsigned int elapsed_ms);
+
+		int duty(void) const {
+			return duty_;
+		}
+
+		size_t writes(void) const {
+			return writes_;
+		}
+
+		size_t failed(void) const {
+			return failed_;
+		}
+
+		const std::string& last_error(void) const {
+			return error_;
+		}
+	};
+
+	// "power" or "clocks", throws on anything else
+	extern actuator* get_actuator(const std::string& name, const nvml::nvmlDevice_t dev, const unsigned int default_limit, const unsigned int min_limit_pct, const unsigned int min_write_ms);
+}
+
+#endif //_ACT_H_
@@ -0,0 +1,200 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#include "attr.h"
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+	// NVML_ERROR_NOT_FOUND, NVML_ERROR_INSUFFICIENT_SIZE
+	const int	NOT_FOUND = 6,
+			INSUFFICIENT_SIZE = 7;
+
+	std::string get_comm(const unsigned int pid) {
+		std::string	c;
+		std::ifstream	istr(("/proc/" + std::to_string(pid) + "/comm").c_str());
+		std::getline(istr, c);
+		// i.e. in another pid namespace
+		return c.empty() ? "?" : c;
+	}
+}
+
+const unsigned int	attr::collector::POLL_MS;
+
+attr::collector::collector(const std::vector<nvml::nvmlDevice_t>& devs) : devs_(devs), util_(64), stop_(false) {
+	if(!nvml::nvmlDeviceGetProcessUtilization && !nvml::nvmlDeviceGetComputeRunningProcesses && !nvml::nvmlDeviceGetGraphicsRunningProcesses)
+		throw std::runtime_error("Loaded NVML can't list the processes running on GPUs, power attribution is not supported");
+	for(size_t i = 0; i < devs_.size(); ++i) {
+		tables_.emplace_back(new table());
+		auto&	t = *tables_.back();
+		t.energy_mj = t.last_mj = 0;
+		t.last_ts = 0;
+		t.n_procs = 0;
+		t.other_mj = t.idle_mj = 0.0;
+	}
+	th_ = std::thread(&collector::loop, this);
+}
+
+attr::collector::~collector() {
+	stop();
+}
+
+attr::proc* attr::collector::get_proc(table& t, const unsigned int pid) {
+	for(size_t i = 0; i < t.n_procs; ++i)
+		if(t.procs[i].pid == pid)
+			return &t.procs[i];
+	proc	*p = &t.procs[t.n_procs];
+	if(t.n_procs < MAX_PROCS) {
+		++t.n_procs;
+	} else {
+		// the table is full, make room
+		// evicting the smallest consumer
+		p = std::min_element(t.procs, t.procs + MAX_PROCS, [](const proc& a, const proc& b) { return a.energy_mj < b.energy_mj; });
+		t.other_mj += p->energy_mj;
+	}
+	*p = { pid, get_comm(pid), 0.0, 0 };
+	return p;
+}
+
+void attr::collector::poll(const size_t idx, const unsigned int elapsed_ms) {
+	auto&						t = *tables_[idx];
+	const auto					dev = devs_[idx];
+	// pid and weight
+	std::vector<std::pair<unsigned int, double>>	w;
+	bool						has_util = false;
+	unsigned long long				last_ts = t.last_ts;
+	if(nvml::nvmlDeviceGetProcessUtilization) {
+		unsigned int	n = util_.size();
+		int		rv = nvml::nvmlDeviceGetProcessUtilization(dev, &util_[0], &n, last_ts);
+		if(rv == INSUFFICIENT_SIZE) {
+			util_.resize(n + 16);
+			n = util_.size();
+			rv = nvml::nvmlDeviceGetProcessUtilization(dev, &util_[0], &n, last_ts);
+		}
+		// no samples since the last poll means
+		// no process used the GPU
+		has_util = !rv || rv == NOT_FOUND;
+		if(!rv) {
+			// a process gets a sample per driver
+			// sampling period, average them
+			std::vector<unsigned int>	cnt;
+			for(unsigned int i = 0; i < n && i < util_.size(); ++i) {
+				const auto&	s = util_[i];
+				if(s.timeStamp > last_ts)
+					last_ts = s.timeStamp;
+				auto	it = std::find_if(w.begin(), w.end(), [&s](const std::pair<unsigned int, double>& v) { return v.first == s.pid; });
+				if(it == w.end()) {
+					w.push_back({ s.pid, 0.0 });
+					cnt.push_back(0);
+					it = w.end() - 1;
+				}
+				it->second += s.smUtil + s.memUtil;
+				++cnt[it - w.begin()];
+			}
+			for(size_t i = 0; i < w.size(); ++i)
+				w[i].second /= cnt[i];
+		}
+	}
+	if(!has_util) {
+		std::vector<unsigned int>	pids;
+		if(nvml::get_running_pids(dev, infos_, pids)) {
+			std::sort(pids.begin(), pids.end());
+			pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+			for(const auto pid : pids)
+				w.push_back({ pid, 1.0 });
+		}
+	}
+	double	sum_w = 0.0;
+	for(const auto& i : w)
+		sum_w += i.second;
+	std::lock_guard<std::mutex>	l(mtx_);
+	t.last_ts = last_ts;
+	const uint64_t	e_mj = t.energy_mj.load(std::memory_order_relaxed);
+	const double	de_mj = (e_mj > t.last_mj) ? e_mj - t.last_mj : 0.0;
+	t.last_mj = e_mj;
+	if(sum_w <= 0.0) {
+		t.idle_mj += de_mj;
+		return;
+	}
+	for(const auto& i : w) {
+		if(i.second <= 0.0)
+			continue;
+		proc	*p = get_proc(t, i.first);
+		p->energy_mj += de_mj*i.second/sum_w;
+		p->active_ms += elapsed_ms;
+	}
+}
+
+void attr::collector::loop(void) {
+	auto				t0 = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex>	l(mtx_);
+	while(true) {
+		cv_.wait_for(l, std::chrono::milliseconds(POLL_MS), [this](){ return stop_; });
+		const bool	last = stop_;
+		l.unlock();
+		const auto		t1 = std::chrono::steady_clock::now();
+		const unsigned int	elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+		t0 = t1;
+		for(size_t i = 0; i < devs_.size(); ++i)
+			poll(i, elapsed_ms);
+		l.lock();
+		if(last)
+			break;
+	}
+}
+
+void attr::collector::stop(void) {
+	{
+		std::lock_guard<std::mutex>	l(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+	if(th_.joinable())
+		th_.join();
+}
+
+void attr::collector::print(std::ostream& os, const size_t idx, const size_t n, const std::string& prefix) const {
+	std::lock_guard<std::mutex>	l(mtx_);
+	const auto&			t = *tables_[idx];
+	std::vector<const proc*>	v;
+	double				total_mj = t.other_mj + t.idle_mj;
+	for(size_t i = 0; i < t.n_procs; ++i) {
+		v.push_back(&t.procs[i]);
+		total_mj += t.procs[i].energy_mj;
+	}
+	std::sort(v.begin(), v.end(), [](const proc* a, const proc* b) { return a->energy_mj > b->energy_mj; });
+	if(v.size() > n)
+		v.resize(n);
+	const double	pct = (total_mj > 0.0) ? 100.0/total_mj : 0.0;
+	char		buf[256];
+	os << prefix << "Energy per process (top " << v.size() << " of " << t.n_procs << "):\n";
+	for(const auto p : v) {
+		std::snprintf(buf, sizeof(buf), "\t%u '%s': %.1fJ (%.1f%%), avg %.1fW over %.1fs\n", p->pid, p->comm.c_str(), p->energy_mj/1000.0, p->energy_mj*pct,
+			      p->active_ms ? p->energy_mj/p->active_ms : 0.0, p->active_ms/1000.0);
+		os << prefix << buf;
+	}
+	if(t.other_mj > 0.0) {
+		std::snprintf(buf, sizeof(buf), "\tother (evicted): %.1fJ (%.1f%%)\n", t.other_mj/1000.0, t.other_mj*pct);
+		os << prefix << buf;
+	}
+	std::snprintf(buf, sizeof(buf), "\tno process: %.1fJ (%.1f%%)\n", t.idle_mj/1000.0, t.idle_mj*pct);
+	os << prefix << buf << std::flush;
+}
@@ -0,0 +1,98 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef _ATTR_H_
+#define _ATTR_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include "nvml.h"
+
+namespace attr {
+	// processes tracked per device, when full the one
+	// with the least energy is folded into 'other'
+	const size_t		MAX_PROCS = 32;
+
+	struct proc {
+		unsigned int	pid;
+		std::string	comm;
+		double		energy_mj;
+		uint64_t	active_ms;
+	};
+
+	// splits the energy drawn by each device across the
+	// processes running on it, weighted by their SM plus
+	// memory utilization (nvmlDeviceGetProcessUtilization),
+	// evenly among the running processes when that's not
+	// available. Runs every POLL_MS on its own thread, the
+	// control loops only publish their energy total
+	class collector {
+		struct table {
+			std::atomic<uint64_t>	energy_mj;
+			uint64_t		last_mj;
+			unsigned long long	last_ts;
+			proc			procs[MAX_PROCS];
+			size_t			n_procs;
+			double			other_mj,
+						idle_mj;
+		};
+
+		const std::vector<nvml::nvmlDevice_t>		devs_;
+		std::vector<std::unique_ptr<table>>		tables_;
+		std::vector<nvml::nvmlProcessUtilizationSample_t>	util_;
+		std::vector<nvml::nvmlProcessInfo_t>		infos_;
+		bool						stop_;
+		mutable std::mutex				mtx_;
+		std::condition_variable				cv_;
+		std::thread					th_;
+
+		proc* get_proc(table& t, const unsigned int pid);
+		void poll(const size_t idx, const unsigned int elapsed_ms);
+		void loop(void);
+	public:
+		static const unsigned int	POLL_MS = 1000;
+
+		// throws when NVML can't list processes
+		collector(const std::vector<nvml::nvmlDevice_t>& devs);
+
+		~collector();
+
+		// polls once more, so that the energy published
+		// since the last poll is accounted too, then
+		// joins the thread
+		void stop(void);
+
+		// to be invoked by the control loop of device
+		// idx, energy_mj is its total so far
+		void publish(const size_t idx, const uint64_t energy_mj) {
+			tables_[idx]->energy_mj.store(energy_mj, std::memory_order_relaxed);
+		}
+
+		// the top n processes of device idx by energy
+		void print(std::ostream& os, const size_t idx, const size_t n, const std::string& prefix) const;
+	};
+}
+
+#endif //_ATTR_H_
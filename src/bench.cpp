@@ -0,0 +1,362 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+// nv-pwr-bench: microbenchmarks of the control loop building
+// blocks and closed loop scenarios of each fan control algorithm
+// against the GPU simulator, driven in simulated time. Results
+// are printed one per line as 'bench key=value ...'
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <getopt.h>
+#include <dlfcn.h>
+#include "ctrl.h"
+#include "nvml.h"
+#include "act.h"
+#include "sched.h"
+#include "tlog.h"
+#include "filt.h"
+#include "lat.h"
+
+namespace {
+	const char	*FAN_CTRLS[] = { "simple", "wavg", "gpu_temp", "pid", "mpc", "ppw", "multi", "frame", "joint" };
+	// scenarios render frames taking FRAME_WORK MHz*ms, i.e.
+	// the target is met down to 1500 MHz
+	const unsigned int	FRAME_TARGET_US = 16667;
+	const double		FRAME_WORK = 1500.0*FRAME_TARGET_US/1000.0;
+
+	struct scenario {
+		std::string	name,
+				workload;
+	};
+
+	namespace opt {
+		std::string		nvml_lib = "./libnvidia-ml-sim.so",
+					only,
+					actuator = "power";
+		unsigned int		duration_s = 600,
+					micro_calls = 200000;
+		bool			micro = true,
+					scenarios = true;
+		std::vector<scenario>	extra;
+	}
+
+	void print_help(const char *prog) {
+		std::cerr <<	"Usage: " << prog << " [options]\n"
+				"Benchmarks the fan control algorithms and the control loop against the GPU simulator\n\n"
+				"    --nvml-lib l    Loads the simulator from 'l', default is '" << opt::nvml_lib << "'\n"
+				"    --duration-s s  Simulated seconds each scenario runs for, default is " << opt::duration_s << "\n"
+				"    --calls n       Calls each microbenchmark times, default is " << opt::micro_calls << "\n"
+				"    --scenario s    Adds scenario 'name=workload' (as NVSIM_WORKLOAD, i.e.\n"
+				"                    'ramp=file:ramp.trace'), can be repeated\n"
+				"    --fan-ctrl f    Only runs fan control algorithm 'f'\n"
+				"    --actuator a    Scenarios use actuator 'a' ('power' or 'clocks'), default is '" << opt::actuator << "'\n"
+				"    --no-micro      Skips the microbenchmarks\n"
+				"    --no-scenarios  Skips the scenarios\n"
+				"    --help          Prints this help and exit\n\n"
+		<< std::flush;
+	}
+
+	int parse_args(int argc, char *argv[], const char *prog) {
+		int			c;
+		static struct option	long_options[] = {
+			{"nvml-lib",	required_argument, 0,	0},
+			{"duration-s",	required_argument, 0,	0},
+			{"calls",	required_argument, 0,	0},
+			{"scenario",	required_argument, 0,	0},
+			{"fan-ctrl",	required_argument, 0,	0},
+			{"actuator",	required_argument, 0,	0},
+			{"no-micro",	no_argument,       0,	0},
+			{"no-scenarios",no_argument,       0,	0},
+			{"help",	no_argument,	   0,	0},
+			{0, 0, 0, 0}
+		};
+
+		while (1) {
+			int		option_index = 0;
+
+			if(-1 == (c = getopt_long(argc, argv, "", long_options, &option_index)))
+				break;
+
+			switch (c) {
+			case 0: {
+				const char	*name = long_options[option_index].name;
+				if(!std::strcmp("help", name)) {
+					print_help(prog);
+					std::exit(0);
+				} else if(!std::strcmp("nvml-lib", name)) {
+					opt::nvml_lib = optarg;
+				} else if(!std::strcmp("duration-s", name)) {
+					const int	d = std::atoi(optarg);
+					if(d > 0)
+						opt::duration_s = d;
+				} else if(!std::strcmp("calls", name)) {
+					const int	n = std::atoi(optarg);
+					if(n > 0)
+						opt::micro_calls = n;
+				} else if(!std::strcmp("scenario", name)) {
+					const char	*eq = std::strchr(optarg, '=');
+					if(!eq || eq == optarg || !eq[1])
+						throw std::runtime_error((std::string("Invalid scenario: ") + optarg).c_str());
+					opt::extra.push_back({ std::string(optarg, eq - optarg), eq + 1 });
+				} else if(!std::strcmp("fan-ctrl", name)) {
+					opt::only = optarg;
+				} else if(!std::strcmp("actuator", name)) {
+					opt::actuator = optarg;
+				} else if(!std::strcmp("no-micro", name)) {
+					opt::micro = false;
+				} else if(!std::strcmp("no-scenarios", name)) {
+					opt::scenarios = false;
+				}
+			} break;
+
+			case '?': {
+				return -1;
+			} break;
+
+			default:
+				throw std::runtime_error((std::string("Invalid option '") + (char)c + "'").c_str());
+			}
+		}
+		return optind;
+	}
+
+	// the simulator extension moving
+	// its time forward
+	typedef int (*fp_nvsimAdvance)(double);
+	fp_nvsimAdvance	nvsim_advance = 0;
+
+	ctrl::params get_params(void) {
+		return { 80, 80, 4, false, true, 10.0, 0.5, 0.0, std::vector<ctrl::constraint>(), FRAME_TARGET_US };
+	}
+
+	template<typename F>
+	void micro(const std::string& name, const size_t calls, F f) {
+		const uint64_t	t0 = lat::now_ns();
+		for(size_t i = 0; i < calls; ++i)
+			f(i);
+		const uint64_t	ns = lat::now_ns() - t0;
+		std::printf("bench kind=micro name=%s calls=%zu ns_per_call=%.1f\n", name.c_str(), calls, 1.0*ns/calls);
+		std::fflush(stdout);
+	}
+
+	// synthetic samples swinging around the targets, so
+	// that all the code paths of the algorithms get used
+	std::vector<ctrl::throttle::data> synthetic(void) {
+		std::vector<ctrl::throttle::data>	rv;
+		for(unsigned int i = 0; i < 4096; ++i) {
+			const unsigned int	ph = i % 256,
+			      			tri = (ph < 128) ? ph : 255 - ph;
+			rv.push_back({ 60 + tri*30/128, 70 + tri*15/128, 50 + (i % 7)*50, 150000 + tri*800, 250000, 100000, 250000, 1400 + tri*4, 100, 70 + tri*20/128, 14000 + tri*40 });
+		}
+		return rv;
+	}
+
+	void run_micro(nvml::nvmlDevice_t dev) {
+		const auto	samples = synthetic();
+		for(const auto name : FAN_CTRLS) {
+			if(!opt::only.empty() && opt::only != name)
+				continue;
+			std::unique_ptr<ctrl::throttle>	thr(ctrl::get_fan_ctrl(name, get_params()));
+			micro(std::string("check.") + name, opt::micro_calls, [&](const size_t i) {
+				float	b_fact = 1.0;
+				auto	d = samples[i % samples.size()];
+				thr->check(d, b_fact);
+			});
+		}
+		filt::pipeline	filt({ "fan=median:5,ewma:2000", "temp=kalman:0.5:4", "pwr=rate:50" });
+		micro("filter.pipeline", opt::micro_calls, [&](const size_t i) {
+			auto	d = samples[i % samples.size()];
+			filt.apply(d);
+		});
+		// sampling and actuation go through NVML, as the
+		// control loop does, but with the simulated time
+		// stopped it doesn't cost any physics
+		nvml::sampler	smp(dev, false);
+		nvml::sample	s;
+		micro("sampler.read", opt::micro_calls, [&](const size_t) {
+			smp.read(s, false);
+		});
+		micro("sampler.read_perf", opt::micro_calls, [&](const size_t) {
+			smp.read(s, true);
+		});
+		unsigned int	def_limit = 0;
+		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementDefaultLimit(dev, &def_limit));
+		{
+			act::pwr_limit	pwr(dev, def_limit, 0, 0);
+			micro("pwr_limit.write", opt::micro_calls, [&](const size_t i) {
+				pwr.apply((i & 1) ? ctrl::action::PWR_INC : ctrl::action::PWR_DEC, 1.0, 250);
+			});
+			micro("pwr_limit.suppressed", opt::micro_calls, [&](const size_t) {
+				pwr.apply(ctrl::action::PWR_INC, 1.0, 250);
+			});
+			pwr.restore();
+		}
+		{
+			// what the control loop pays with the writer
+			// thread, most targets get superseded
+			act::pwr_limit	pwr(dev, def_limit, 0, 0);
+			pwr.start();
+			micro("pwr_limit.write_async", opt::micro_calls, [&](const size_t i) {
+				pwr.apply((i & 1) ? ctrl::action::PWR_INC : ctrl::action::PWR_DEC, 1.0, 250);
+			});
+			pwr.restore();
+		}
+		// what the control loop pays to log a sample,
+		// popping as the writer thread would, as any
+		// producer faster than the output would only
+		// measure dropping samples
+		tlog::ring	rng(4096);
+		tlog::record	r;
+		micro("tlog.ring", opt::micro_calls, [&](const size_t i) {
+			rng.push({ i, 0, 70, 80, 200000, 220000, 0, 250, false });
+			rng.pop(r);
+		});
+		// a whole iteration of the control loop,
+		// without waiting for the next deadline
+		std::unique_ptr<ctrl::throttle>	thr(ctrl::get_fan_ctrl("gpu_temp", get_params()));
+		act::pwr_limit			pwr(dev, def_limit, 0, 500);
+		sched::adaptive			adp(50, 250, 2000, 80, 80);
+		micro("loop.iteration", opt::micro_calls, [&](const size_t i) {
+			smp.read(s, thr->needs_perf());
+			rng.push({ i, 0, s.fan_speed, s.gpu_temp, s.gpu_pwr, pwr.target(), s.mem_temp, 250, s.has_mem_temp });
+			rng.pop(r);
+			float		b_fact = 1.0;
+			const auto	a = thr->check({ s.fan_speed, s.gpu_temp, 250, s.gpu_pwr, pwr.target(), pwr.min_limit(), pwr.max_limit(), s.sm_clock, s.gpu_util, s.mem_temp, 0 }, b_fact);
+			pwr.apply(a, b_fact, 250);
+			adp.next(s.fan_speed, s.gpu_temp, 250);
+		});
+		pwr.restore();
+	}
+
+	// closed loop in simulated time: the GPU moves forward by
+	// exactly the interval the adaptive sampling picks
+	void run_scenario(const scenario& sc, const char* fan_ctrl) {
+		const unsigned int	MAX_FAN = 80,
+		      			MAX_TEMP = 80;
+		setenv("NVSIM_WORKLOAD", sc.workload.c_str(), 1);
+		SAFE_NVML_CALL(nvml::nvmlInit_v2());
+		const auto			dev = nvml::get_device_by_id(0, nvml::get_device_count(false));
+		unsigned int			def_limit = 0;
+		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementDefaultLimit(dev, &def_limit));
+		std::unique_ptr<ctrl::throttle>	thr(ctrl::get_fan_ctrl(fan_ctrl, get_params()));
+		std::unique_ptr<act::actuator>	act(act::get_actuator(opt::actuator, dev, def_limit, 0, 500));
+		act::actuator&			pwr = *act;
+		// when the throttle drives the fans
+		std::unique_ptr<act::fan_duty>	fan(thr->drives_fans() ? new act::fan_duty(dev, 500) : 0);
+		nvml::sampler			smp(dev, false);
+		sched::adaptive			adp(50, 250, 2000, MAX_FAN, MAX_TEMP);
+		SAFE_NVML_CALL(nvsim_advance(0.0));
+		unsigned int			elapsed_ms = 0,
+						max_temp = 0,
+						max_fan = 0;
+		uint64_t			t_ms = 0,
+						temp_above_ms = 0,
+						fan_above_ms = 0,
+						settle_ms = 0,
+						frame_miss_ms = 0;
+		double				pwr_mj = 0.0,
+						clock_ms = 0.0;
+		const uint64_t			t0 = lat::now_ns();
+		while(t_ms < opt::duration_s*1000ULL) {
+			nvml::sample	s;
+			// clocks are read anyway, for the metrics
+			smp.read(s, true);
+			pwr_mj += 1.0*s.gpu_pwr*elapsed_ms/1000.0;
+			clock_ms += 1.0*s.sm_clock*elapsed_ms;
+			if(s.gpu_temp > max_temp)
+				max_temp = s.gpu_temp;
+			if(s.fan_speed > max_fan)
+				max_fan = s.fan_speed;
+			if(s.gpu_temp > MAX_TEMP)
+				temp_above_ms += elapsed_ms;
+			if(s.fan_speed > MAX_FAN)
+				fan_above_ms += elapsed_ms;
+			if(s.gpu_temp > MAX_TEMP || s.fan_speed > MAX_FAN)
+				settle_ms = t_ms;
+			// frame time as the GPU clock allows
+			const unsigned int	frame_us = s.sm_clock ? static_cast<unsigned int>(1000.0*FRAME_WORK/s.sm_clock) : 0;
+			if(frame_us > FRAME_TARGET_US)
+				frame_miss_ms += elapsed_ms;
+			float		b_fact = 1.0;
+			const auto	a = thr->check({ s.fan_speed, s.gpu_temp, elapsed_ms, s.gpu_pwr, pwr.target(), pwr.min_limit(), pwr.max_limit(),
+							 thr->needs_perf() ? s.sm_clock : 0, thr->needs_perf() ? s.gpu_util : 0, s.has_mem_temp ? s.mem_temp : 0, frame_us }, b_fact);
+			pwr.apply(a, b_fact, elapsed_ms);
+			if(fan && thr->fan_target() >= 0)
+				fan->set(thr->fan_target(), elapsed_ms);
+			elapsed_ms = adp.next(s.fan_speed, s.gpu_temp, elapsed_ms);
+			SAFE_NVML_CALL(nvsim_advance(elapsed_ms/1000.0));
+			t_ms += elapsed_ms;
+		}
+		const double	wall_ms = (lat::now_ns() - t0)/1000000.0;
+		std::printf("bench kind=scenario name=%s fan_ctrl=%s actuator=%s sim_s=%.1f settle_s=%.2f temp_overshoot_c=%u temp_above_s=%.2f fan_overshoot_pct=%u fan_above_s=%.2f "
+			    "limit_writes=%zu avg_pwr_w=%.2f avg_clock_mhz=%.1f frame_miss_pct=%.2f wall_ms=%.1f\n", sc.name.c_str(), fan_ctrl, pwr.name(), t_ms/1000.0, settle_ms/1000.0,
+			    (max_temp > MAX_TEMP) ? max_temp - MAX_TEMP : 0, temp_above_ms/1000.0, (max_fan > MAX_FAN) ? max_fan - MAX_FAN : 0, fan_above_ms/1000.0,
+			    pwr.get_stats().issued, pwr_mj/t_ms, clock_ms/t_ms, 100.0*frame_miss_ms/t_ms, wall_ms);
+		std::fflush(stdout);
+		pwr.restore();
+		if(fan)
+			fan->restore();
+		SAFE_NVML_CALL(nvml::nvmlShutdown());
+	}
+}
+
+int main(int argc, char *argv[]) {
+	try {
+		if(parse_args(argc, argv, argv[0]) < 0)
+			return -1;
+		// the simulator reads its settings at init,
+		// scenarios set their own workload
+		std::unique_ptr<void, void(*)(void*)>	nvml_so(dlopen(opt::nvml_lib.c_str(), RTLD_LAZY|RTLD_LOCAL), [](void* p){ if(p) dlclose(p); });
+		if(!nvml_so)
+			throw std::runtime_error((std::string("Can't load the GPU simulator (build it with 'make sim'): ") + dlerror()).c_str());
+		nvml::load_functions(nvml_so.get());
+		nvsim_advance = (fp_nvsimAdvance)dlsym(nvml_so.get(), "nvsimAdvance");
+		if(!nvsim_advance)
+			throw std::runtime_error((std::string("'") + opt::nvml_lib + "' isn't the GPU simulator, benchmarks never run on real GPUs").c_str());
+		setenv("NVSIM_GPUS", "1", 1);
+		if(opt::micro) {
+			SAFE_NVML_CALL(nvml::nvmlInit_v2());
+			const auto	dev = nvml::get_device_by_id(0, nvml::get_device_count(false));
+			SAFE_NVML_CALL(nvsim_advance(0.0));
+			run_micro(dev);
+			SAFE_NVML_CALL(nvml::nvmlShutdown());
+		}
+		if(opt::scenarios) {
+			// steady full load, load going on and off
+			// and a load the GPU can sustain unthrottled
+			std::vector<scenario>	scs = { { "steady", "const:280" }, { "burst", "square:300:80:30" }, { "light", "const:140" } };
+			scs.insert(scs.end(), opt::extra.begin(), opt::extra.end());
+			for(const auto& sc : scs)
+				for(const auto name : FAN_CTRLS)
+					if(opt::only.empty() || opt::only == name)
+						run_scenario(sc, name);
+		}
+	} catch(const std::exception& e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		return -1;
+	} catch(...) {
+		std::cerr << "Unknown exception" << std::endl;
+		return -1;
+	}
+}
@@ -0,0 +1,98 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "budget.h"
+#include <chrono>
+#include <algorithm>
+
+namespace {
+	// i.e. fan speed or temperature 2 units from target
+	const int		HOT_HEADROOM = 2;
+	// of the max limit
+	const double		MARGIN = 0.1;
+
+	uint64_t now_ns(void) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// adds up to 'left' to alloc, proportionally to w and
+	// without going above tgt; returns what's left
+	double fill(const std::vector<double>& tgt, const std::vector<double>& w, std::vector<double>& alloc, double left) {
+		while(left >= 1.0) {
+			double	sum_w = 0.0;
+			for(size_t i = 0; i < alloc.size(); ++i)
+				if(alloc[i] + 1.0 <= tgt[i])
+					sum_w += w[i];
+			if(sum_w <= 0.0)
+				break;
+			double	given = 0.0;
+			for(size_t i = 0; i < alloc.size(); ++i) {
+				if(alloc[i] + 1.0 > tgt[i])
+					continue;
+				const double	add = std::min(tgt[i] - alloc[i], left*w[i]/sum_w);
+				alloc[i] += add;
+				given += add;
+			}
+			left -= given;
+			if(given < 1.0)
+				break;
+		}
+		return left;
+	}
+}
+
+const unsigned int	budget::allocator::ALLOC_MS;
+
+budget::allocator::allocator(const unsigned int total_mw, const size_t n_gpus) : total_(total_mw), reps_(n_gpus), seen_(n_gpus, false), shares_(n_gpus, total_mw/n_gpus), last_ns_(0) {
+}
+
+void budget::allocator::allocate(void) {
+	const size_t		n = reps_.size();
+	std::vector<double>	need(n),
+				max(n),
+				w(n),
+				alloc(n);
+	double			left = total_;
+	for(size_t i = 0; i < n; ++i) {
+		const auto&	r = reps_[i];
+		const double	margin = MARGIN*r.max_limit;
+		if(r.headroom > HOT_HEADROOM && r.gpu_pwr + 0.5*margin >= r.pwr_limit)
+			need[i] = r.max_limit;
+		else
+			need[i] = std::min(1.0*r.max_limit, std::max(1.0*r.gpu_pwr, (r.headroom > HOT_HEADROOM) ? 0.0 : 1.0*r.pwr_limit) + margin);
+		max[i] = r.max_limit;
+		alloc[i] = r.min_limit;
+		left -= r.min_limit;
+		w[i] = (std::max(r.gpu_util, 5U))*(1.0 + std::min(std::max(r.headroom, 0), 20)/10.0);
+	}
+	if(left > 0.0)
+		fill(max, w, alloc, fill(need, w, alloc, left));
+	for(size_t i = 0; i < n; ++i)
+		shares_[i] = alloc[i];
+}
+
+unsigned int budget::allocator::update(const size_t idx, const report& r) {
+	std::lock_guard<std::mutex>	l(mtx_);
+	reps_[idx] = r;
+	seen_[idx] = true;
+	const uint64_t			now = now_ns();
+	if(now - last_ns_ >= ALLOC_MS*1000000ULL && std::find(seen_.begin(), seen_.end(), false) == seen_.end()) {
+		last_ns_ = now;
+		allocate();
+	}
+	return shares_[idx];
+}
@@ -0,0 +1,68 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+namespace budget {
+	// what a GPU control loop reports every sample; power
+	// values are in mW, pwr_limit is the current target and
+	// headroom the distance from the closest of the max fan
+	// speed (%) and max temperature (C) targets
+	struct report {
+		unsigned int	gpu_pwr,
+				pwr_limit,
+				min_limit,
+				max_limit,
+				gpu_util;
+		int		headroom;
+	};
+
+	// splits a node-wide power budget across GPUs, once every
+	// ALLOC_MS: each GPU first gets its min limit, then the rest
+	// goes to the GPUs which need more, weighted by utilization
+	// and thermal headroom. A GPU needs its max limit when drawing
+	// all of its target (unless close to its own thermal targets,
+	// where its fan control is the one holding it back), else what
+	// it draws plus a margin. Budget left once all the needs are
+	// met is spread too, to absorb load spikes
+	class allocator {
+		const unsigned int		total_;
+		std::mutex			mtx_;
+		std::vector<report>		reps_;
+		std::vector<bool>		seen_;
+		std::vector<unsigned int>	shares_;
+		uint64_t			last_ns_;
+
+		void allocate(void);
+	public:
+		static const unsigned int	ALLOC_MS = 1000;
+
+		allocator(const unsigned int total_mw, const size_t n_gpus);
+
+		// stores the latest report of GPU idx, returns
+		// its current share (mW); invoked by device loops
+		unsigned int update(const size_t idx, const report& r);
+	};
+}
+
+#endif //_BUDGET_H_
@@ -0,0 +1,176 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "ctl.h"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+const char	*ctl::SOCK_PATH = "/run/nv-pwr-ctrl.sock";
+
+namespace {
+	const size_t	MAX_CMD = 1024;
+
+	struct sockaddr_un get_addr(const std::string& path) {
+		struct sockaddr_un	addr;
+		std::memset(&addr, 0x00, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path))
+			throw std::runtime_error((std::string("Control socket path too long: '") + path + "'").c_str());
+		std::strcpy(addr.sun_path, path.c_str());
+		return addr;
+	}
+
+	int connect_to(const std::string& path) {
+		const struct sockaddr_un	addr = get_addr(path);
+		const int			fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+		if(fd < 0)
+			throw std::runtime_error((std::string("socket failed: ") + std::strerror(errno)).c_str());
+		if(connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr))) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	bool write_all(const int fd, const std::string& s) {
+		size_t	done = 0;
+		while(done < s.size()) {
+			const ssize_t	rv = write(fd, s.data() + done, s.size() - done);
+			if(rv < 0 && errno == EINTR)
+				continue;
+			if(rv <= 0)
+				return false;
+			done += rv;
+		}
+		return true;
+	}
+
+	// reads until new line or EOF
+	std::string read_line(const int fd, const size_t max_sz) {
+		std::string	s;
+		char		buf[256];
+		while(s.size() < max_sz) {
+			const ssize_t	rv = read(fd, buf, sizeof(buf));
+			if(rv < 0 && errno == EINTR)
+				continue;
+			if(rv <= 0)
+				break;
+			s.append(buf, rv);
+			if(std::memchr(buf, '\n', rv))
+				break;
+		}
+		const size_t	nl = s.find_first_of("\r\n");
+		if(nl != std::string::npos)
+			s.resize(nl);
+		return s;
+	}
+}
+
+ctl::server::server(const std::string& path, const handler& h) : path_(path), h_(h), lfd_(-1), efd_(-1) {
+	const struct sockaddr_un	addr = get_addr(path_);
+	// a left over socket of a process
+	// which didn't quit cleanly
+	const int			prev_fd = connect_to(path_);
+	if(prev_fd >= 0) {
+		close(prev_fd);
+		throw std::runtime_error((std::string("Another instance is listening on '") + path_ + "'").c_str());
+	}
+	unlink(path_.c_str());
+	if(-1 == (lfd_ = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)))
+		throw std::runtime_error((std::string("socket failed: ") + std::strerror(errno)).c_str());
+	// only the owner (i.e. root) can change settings
+	const mode_t	prev_mask = umask(0077);
+	const int	rv = bind(lfd_, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr));
+	umask(prev_mask);
+	if(rv || listen(lfd_, 4) || -1 == (efd_ = eventfd(0, EFD_CLOEXEC))) {
+		const int	err = errno;
+		close(lfd_);
+		unlink(path_.c_str());
+		throw std::runtime_error((std::string("Can't listen on '") + path_ + "': " + std::strerror(err)).c_str());
+	}
+	th_ = std::thread(&server::loop, this);
+}
+
+ctl::server::~server() {
+	const uint64_t	v = 1;
+	if(write(efd_, &v, sizeof(v))) {
+	}
+	if(th_.joinable())
+		th_.join();
+	close(efd_);
+	close(lfd_);
+	unlink(path_.c_str());
+}
+
+void ctl::server::loop(void) {
+	while(true) {
+		struct pollfd	pfd[2] = { { lfd_, POLLIN, 0 }, { efd_, POLLIN, 0 } };
+		if(poll(pfd, 2, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		if(pfd[1].revents)
+			break;
+		if(!pfd[0].revents)
+			continue;
+		const int	fd = accept4(lfd_, 0, 0, SOCK_CLOEXEC);
+		if(fd < 0)
+			continue;
+		// a client not sending its command
+		// can't hold the socket for long
+		struct timeval	tv = { 1, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		const std::string	cmd = read_line(fd, MAX_CMD);
+		std::string		reply;
+		try {
+			reply = h_(cmd);
+		} catch(const std::exception& e) {
+			reply = std::string("ERR ") + e.what() + "\n";
+		}
+		write_all(fd, reply);
+		close(fd);
+	}
+}
+
+std::string ctl::request(const std::string& path, const std::string& cmd) {
+	const int	fd = connect_to(path);
+	if(fd < 0)
+		throw std::runtime_error((std::string("Can't connect to '") + path + "' (is nv-pwr-ctrl running with '--daemon'?): " + std::strerror(errno)).c_str());
+	std::string	reply;
+	if(write_all(fd, cmd + "\n")) {
+		shutdown(fd, SHUT_WR);
+		char	buf[1024];
+		ssize_t	rv;
+		while((rv = read(fd, buf, sizeof(buf))) > 0 || (rv < 0 && errno == EINTR)) {
+			if(rv > 0)
+				reply.append(buf, rv);
+		}
+	}
+	close(fd);
+	return reply;
+}
@@ -0,0 +1,57 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _CTL_H_
+#define _CTL_H_
+
+#include <string>
+#include <thread>
+#include <functional>
+
+namespace ctl {
+	// default control socket
+	extern const char	*SOCK_PATH;
+
+	// gets a command line and returns the reply, which
+	// starts with "OK" or "ERR"
+	typedef std::function<std::string(const std::string&)>	handler;
+
+	// Unix domain control socket, only accessible by the
+	// user running nv-pwr-ctrl. Each connection sends
+	// a single command line and gets back the reply;
+	// commands are handled on a dedicated thread, one
+	// at a time
+	class server {
+		const std::string	path_;
+		handler			h_;
+		int			lfd_,
+					efd_;
+		std::thread		th_;
+
+		void loop(void);
+	public:
+		server(const std::string& path, const handler& h);
+
+		~server();
+	};
+
+	// sends cmd to the server listening on path and
+	// returns the reply
+	extern std::string request(const std::string& path, const std::string& cmd);
+}
+
+#endif //_CTL_H_
@@ -19,24 +19,36 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
 namespace {
 	class simple_fan_speed_th : public ctrl::throttle {
-		const unsigned int      mfs_,
-					mgt_,
-					rps_;
-		unsigned int		cnt_;
+		unsigned int		mfs_,
+					mgt_;
+		const unsigned int	rps_;
+		unsigned int		acc_ms_;
 	public:
-		simple_fan_speed_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), cnt_(0) {
+		simple_fan_speed_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), acc_ms_(0) {
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
 		}
 
 		virtual ctrl::action check(const data& d, float& bump_factor) {
-			++cnt_;
-			cnt_ = cnt_%rps_;
-			if(cnt_)
+			// decide once a second
+			acc_ms_ += d.elapsed_ms;
+			if(acc_ms_ < 1000)
 				return ctrl::action::PWR_CNST;
 
-			bump_factor = 1.0*rps_;
+			bump_factor = 1.0*rps_*acc_ms_/1000.0;
+			acc_ms_ = 0;
 			// ensure the temp is below the threshold
 			if(d.gpu_temp >= mgt_)
 				return ctrl::action::PWR_DEC;
@@ -50,41 +62,48 @@ namespace {
 	};
 
 	class wavg_fan_speed_th : public ctrl::throttle {
-		const unsigned int		mfs_,
+		unsigned int			mfs_,
 						mgt_;
+		const unsigned int		window_ms_;
+		const double			window_sz_;
 		const bool			verbose_;
-		std::vector<unsigned int>	wfs_;
-		unsigned int			cnt_;
+		double				fs_accum_;
+		unsigned int			acc_ms_,
+						prev_ms_;
 
-		double get_w_avg(void) const {
-			const auto	sz = wfs_.size();
-			const double	pre_weight = 0.75 / (sz-1),
-			      		post_weight = 0.25;
-			double		accum = 0.0;
-			for(unsigned int i = 0; i < sz; ++i) {
-				const unsigned int	cur_el = (i+cnt_)%sz;
-				if(i < sz-1) accum += pre_weight*wfs_[cur_el];
-				else accum += post_weight*wfs_[cur_el];
-			}
-			return 1.0*mfs_ - accum;
+		// the latest sample weights 25%, all the
+		// previous ones in the window 75%, each
+		// proportionally to its duration
+		double get_w_avg(const unsigned int fan_speed) const {
+			const double	pre_avg = (prev_ms_) ? fs_accum_/prev_ms_ : fan_speed;
+			return 1.0*mfs_ - (0.75*pre_avg + 0.25*fan_speed);
 		}
 	public:
-		wavg_fan_speed_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), verbose_(p.verbose), cnt_(0) {
+		wavg_fan_speed_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), window_ms_(4000), window_sz_(4.0*p.rep_per_second),
+			verbose_(p.verbose), fs_accum_(0.0), acc_ms_(0), prev_ms_(0) {
 			// will decide an action every 4
 			// seconds
-			wfs_.resize(4*p.rep_per_second);
-			for(auto& i : wfs_)
-				wfs_[i] = mfs_;
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
 		}
 
 		virtual ctrl::action check(const data& d, float& bump_factor) {
-			wfs_[cnt_++] = d.fan_speed;
-			cnt_ = cnt_%(wfs_.size());
-			if(cnt_)
+			acc_ms_ += d.elapsed_ms;
+			if(acc_ms_ < window_ms_) {
+				fs_accum_ += 1.0*d.fan_speed*d.elapsed_ms;
+				prev_ms_ += d.elapsed_ms;
 				return ctrl::action::PWR_CNST;
-			// set returned values
-			bump_factor = 1.0;
-			const double	avg = get_w_avg();
+			}
+			// set returned values, scaling with
+			// the actual window length
+			bump_factor = 1.0*acc_ms_/window_ms_;
+			const double	avg = get_w_avg(d.fan_speed);
+			fs_accum_ = 0.0;
+			acc_ms_ = prev_ms_ = 0;
 			if(verbose_)
 				std::cerr << __FUNCTION__ << " Average: " << avg << "\ttemp: " << d.gpu_temp << std::endl;
 			// ensure the temp is below the threshold
@@ -92,10 +111,10 @@ namespace {
 				return ctrl::action::PWR_DEC;
 
 			if(avg <= -0.5) {
-				bump_factor *= -1.0*wfs_.size()*avg;
+				bump_factor *= -1.0*window_sz_*avg;
 				return ctrl::action::PWR_DEC;
 			} else if(avg >= 0.5) {
-				bump_factor *= 0.5*wfs_.size()*avg;
+				bump_factor *= 0.5*window_sz_*avg;
 				return ctrl::action::PWR_INC;
 			}
 			return ctrl::action::PWR_CNST;
@@ -103,20 +122,26 @@ namespace {
 	};
 
 	class simple_gpu_temp_th : public ctrl::throttle {
-		const unsigned int	mgt_,
-					rps_;
-		unsigned int		cnt_;
+		unsigned int		mgt_;
+		const unsigned int	rps_;
+		unsigned int		acc_ms_;
 	public:
-		simple_gpu_temp_th(const ctrl::params& p) : mgt_(p.max_gpu_temp), rps_(p.rep_per_second), cnt_(0) {
+		simple_gpu_temp_th(const ctrl::params& p) : mgt_(p.max_gpu_temp), rps_(p.rep_per_second), acc_ms_(0) {
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mgt_ = max_gpu_temp;
+			return true;
 		}
 
 		virtual ctrl::action check(const data& d, float& bump_factor) {
-			++cnt_;
-			cnt_ = cnt_%rps_;
-			if(cnt_)
+			// decide once a second
+			acc_ms_ += d.elapsed_ms;
+			if(acc_ms_ < 1000)
 				return ctrl::action::PWR_CNST;
 
-			bump_factor = 1.0*rps_;
+			bump_factor = 1.0*rps_*acc_ms_/1000.0;
+			acc_ms_ = 0;
 
 			if(d.gpu_temp >= mgt_) {
 				return ctrl::action::PWR_DEC;
@@ -126,6 +151,1049 @@ namespace {
 		}
 	};
 
+	// turns a target power limit (mW) into the action
+	// and bump factor to get there from the current one
+	ctrl::action to_action(const ctrl::throttle::data& d, const double u, float& bump_factor) {
+		const double	delta = u - d.pwr_limit;
+		if(std::fabs(delta) < ctrl::PWR_DELTA)
+			return ctrl::action::PWR_CNST;
+		bump_factor = std::fabs(delta)/ctrl::PWR_DELTA;
+		return (delta > 0.0) ? ctrl::action::PWR_INC : ctrl::action::PWR_DEC;
+	}
+
+	// while fan speed or temperature are over target
+	// lowers a cap on the power limit as 'simple' would,
+	// proportionally to the excess
+	class over_cap {
+		double		cap_;
+		bool		capping_;
+	public:
+		over_cap() : cap_(0.0), capping_(false) {
+		}
+
+		// lowers u to the cap, returns true when capping
+		bool apply(const ctrl::throttle::data& d, const unsigned int mfs, const unsigned int mgt, const unsigned int rps, double& u) {
+			const int	over_f = static_cast<int>(d.fan_speed) - static_cast<int>(mfs),
+			      		over_t = static_cast<int>(d.gpu_temp) - static_cast<int>(mgt) + 1,
+			      		over = (over_f > over_t) ? over_f : over_t;
+			if(over <= 0) {
+				capping_ = false;
+				return false;
+			}
+			if(!capping_ || cap_ > d.pwr_limit)
+				cap_ = d.pwr_limit;
+			capping_ = true;
+			cap_ -= 1.0*over*rps*ctrl::PWR_DELTA*d.elapsed_ms/1000.0;
+			if(cap_ < d.min_pwr_limit)
+				cap_ = d.min_pwr_limit;
+			if(u > cap_)
+				u = cap_;
+			return true;
+		}
+	};
+
+	// drives the power limit from the headroom below
+	// the max temperature or fan speed (whichever is
+	// smaller), with anti-windup against the min/max
+	// limits. Unless gains are given, relay feedback
+	// auto-tunes them the first time the GPU reaches
+	// the target: the limit is switched between max
+	// and a lower value around the target, and the
+	// period and amplitude of the resulting oscillation
+	// give the gains (Tyreus-Luyben)
+	class pid_th : public ctrl::throttle {
+		enum phase {
+			WAIT = 0,
+			TUNE,
+			RUN
+		};
+
+		unsigned int		mfs_,
+					mgt_;
+		const bool		verbose_;
+		// gains are per mW
+		double			kp_,
+					ki_,
+					kd_,
+					i_,
+					prev_e_,
+					de_;
+		bool			init_;
+		phase			ph_;
+		// relay auto-tune state
+		bool			relay_hi_;
+		unsigned int		tune_ms_,
+					n_cycles_;
+		double			cycle_start_s_,
+					periods_s_,
+					e_min_,
+					e_max_,
+					ampl_,
+					relay_d_;
+
+		// the error is centered between two
+		// integer readings, aiming to stay
+		// in between target-1 and target
+		double get_error(const data& d) const {
+			const double	e_t = 1.0*mgt_ - d.gpu_temp,
+			      		e_f = 1.0*mfs_ - d.fan_speed;
+			return ((e_t < e_f) ? e_t : e_f) - 0.5;
+		}
+
+		ctrl::action tune(const data& d, const double e, float& bump_factor) {
+			const double	HYST = 1.0,
+			      		now_s = tune_ms_/1000.0;
+			const unsigned int	MAX_TUNE_MS = 15*60*1000,
+			      			N_CYCLES = 3;
+			tune_ms_ += d.elapsed_ms;
+			if(e < e_min_) e_min_ = e;
+			if(e > e_max_) e_max_ = e;
+			if(relay_hi_ && e < -HYST) {
+				relay_hi_ = false;
+			} else if(!relay_hi_ && e > HYST) {
+				// a full cycle completed, the first
+				// one is discarded as transient
+				relay_hi_ = true;
+				if(n_cycles_ >= 2) {
+					periods_s_ += now_s - cycle_start_s_;
+					ampl_ += 0.5*(e_max_ - e_min_);
+				}
+				++n_cycles_;
+				cycle_start_s_ = now_s;
+				e_min_ = e_max_ = e;
+			}
+			if(n_cycles_ > N_CYCLES) {
+				const double	tu = periods_s_/(N_CYCLES - 1),
+				      		a = ampl_/(N_CYCLES - 1);
+				if(a > 0.0 && tu > 0.0 && relay_d_ > 0.0) {
+					// ultimate gain, per mW
+					const double	ku = 4.0*relay_d_/(M_PI*a);
+					// Tyreus-Luyben PI, no derivative
+					// as readings are integers
+					kp_ = ku/3.2;
+					ki_ = kp_/(2.2*tu);
+					kd_ = 0.0;
+					std::cerr << "pid: auto-tuned gains (Tu " << tu << "s, amplitude " << a << "), use '--pid-gains "
+						  << kp_/1000.0 << "," << ki_/1000.0 << "," << kd_/1000.0 << "' to skip auto-tuning" << std::endl;
+				} else {
+					std::cerr << "pid: auto-tuning failed, keeping default gains" << std::endl;
+				}
+				ph_ = RUN;
+				i_ = d.pwr_limit;
+				return ctrl::action::PWR_CNST;
+			}
+			if(tune_ms_ > MAX_TUNE_MS) {
+				std::cerr << "pid: auto-tuning timed out, keeping default gains" << std::endl;
+				ph_ = RUN;
+				i_ = d.pwr_limit;
+				return ctrl::action::PWR_CNST;
+			}
+			// relay swings between max and the middle
+			// of the allowed range
+			const double	hi = d.max_pwr_limit,
+			      		lo = 0.5*(d.min_pwr_limit + d.max_pwr_limit);
+			relay_d_ = 0.5*(hi - lo);
+			return to_action(d, relay_hi_ ? hi : lo, bump_factor);
+		}
+	public:
+		pid_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), verbose_(p.verbose),
+			kp_(p.pid_kp*1000.0), ki_(p.pid_ki*1000.0), kd_(p.pid_kd*1000.0), i_(0.0), prev_e_(0.0), de_(0.0), init_(false),
+			ph_(p.pid_tune ? WAIT : RUN), relay_hi_(false), tune_ms_(0), n_cycles_(0), cycle_start_s_(-1.0),
+			periods_s_(0.0), e_min_(0.0), e_max_(0.0), ampl_(0.0), relay_d_(0.0) {
+		}
+
+		// gains, once tuned
+		virtual std::string save(void) const {
+			if(ph_ != RUN)
+				return "";
+			std::ostringstream	oss;
+			oss.precision(10);
+			oss << kp_ << " " << ki_ << " " << kd_;
+			return oss.str();
+		}
+
+		virtual bool load(const std::string& s) {
+			std::istringstream	iss(s);
+			double			kp = 0.0,
+						ki = 0.0,
+						kd = 0.0;
+			if(!(iss >> kp >> ki >> kd) || kp <= 0.0)
+				return false;
+			kp_ = kp;
+			ki_ = ki;
+			kd_ = kd;
+			ph_ = RUN;
+			return true;
+		}
+
+		// the integral carries on from the
+		// current output, hence is bumpless
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			const double	e = get_error(d),
+			      		dt = d.elapsed_ms/1000.0;
+			if(!init_) {
+				// bumpless start from the current limit
+				i_ = d.pwr_limit;
+				prev_e_ = e;
+				init_ = true;
+			}
+			// start auto-tuning once we get close to the target
+			if(ph_ == WAIT && e < 1.0) {
+				if(verbose_)
+					std::cerr << "pid: starting auto-tuning" << std::endl;
+				ph_ = TUNE;
+				e_min_ = e_max_ = e;
+			}
+			if(ph_ == TUNE)
+				return tune(d, e, bump_factor);
+			if(dt <= 0.0)
+				return ctrl::action::PWR_CNST;
+			// filtered derivative, readings have
+			// 1 unit resolution
+			const double	ALPHA = 0.2;
+			de_ = (1.0 - ALPHA)*de_ + ALPHA*(e - prev_e_)/dt;
+			prev_e_ = e;
+			i_ += ki_*e*dt;
+			const double	u_raw = kp_*e + i_ + kd_*de_;
+			double		u = u_raw;
+			if(u > d.max_pwr_limit)
+				u = d.max_pwr_limit;
+			else if(u < d.min_pwr_limit)
+				u = d.min_pwr_limit;
+			// anti-windup: back-calculate the integral
+			// so that the output is at the limit
+			i_ -= u_raw - u;
+			if(verbose_)
+				std::cerr << __FUNCTION__ << " e: " << e << "\tp: " << kp_*e << "\ti: " << i_ << "\td: " << kd_*de_ << "\tu: " << u << std::endl;
+			return to_action(d, u, bump_factor);
+		}
+	};
+
+	// recursive least squares with exponential
+	// forgetting over 3 parameters; forgetting
+	// stops when the covariance grows too much
+	// (i.e. readings are steady and don't carry
+	// any new information)
+	class rls3 {
+		const double	lambda_,
+				max_trace_;
+		double		th_[3],
+				p_[3][3];
+	public:
+		rls3(const double lambda, const double p0, const double th0, const double th1, const double th2) : lambda_(lambda), max_trace_(3.0*p0) {
+			th_[0] = th0;
+			th_[1] = th1;
+			th_[2] = th2;
+			for(int i = 0; i < 3; ++i)
+				for(int j = 0; j < 3; ++j)
+					p_[i][j] = (i == j) ? p0 : 0.0;
+		}
+
+		void update(const double x[3], const double y) {
+			double	px[3],
+				den = 0.0,
+				err = y;
+			for(int i = 0; i < 3; ++i) {
+				px[i] = p_[i][0]*x[0] + p_[i][1]*x[1] + p_[i][2]*x[2];
+				den += x[i]*px[i];
+				err -= th_[i]*x[i];
+			}
+			const double	tr = p_[0][0] + p_[1][1] + p_[2][2],
+			      		l = (tr < max_trace_) ? lambda_ : 1.0;
+			den += l;
+			for(int i = 0; i < 3; ++i)
+				th_[i] += px[i]/den*err;
+			for(int i = 0; i < 3; ++i)
+				for(int j = 0; j < 3; ++j)
+					p_[i][j] = (p_[i][j] - px[i]*px[j]/den)/l;
+		}
+
+		double operator[](const int i) const {
+			return th_[i];
+		}
+
+		void save(std::ostream& os) const {
+			for(int i = 0; i < 3; ++i)
+				os << th_[i] << " ";
+			for(int i = 0; i < 3; ++i)
+				for(int j = 0; j < 3; ++j)
+					os << p_[i][j] << " ";
+		}
+
+		bool load(std::istream& is) {
+			for(int i = 0; i < 3; ++i)
+				is >> th_[i];
+			for(int i = 0; i < 3; ++i)
+				for(int j = 0; j < 3; ++j)
+					is >> p_[i][j];
+			return !is.fail();
+		}
+	};
+
+	// learns, once a second, a first order model of
+	// GPU temperature (driven by power) and fan speed
+	// (driven by temperature) and sets the highest power
+	// limit which keeps both under target at the end of
+	// the prediction horizon. Being first order, the
+	// temperature trajectory is monotone hence checking
+	// the last step is enough. Until the model is trained
+	// and makes physical sense, it behaves like 'simple'
+	class mpc_th : public ctrl::throttle {
+		unsigned int		mfs_,
+					mgt_;
+		const unsigned int	rps_;
+		const bool		verbose_;
+		// model step is 1s, fits are
+		// in C, % and W
+		static const unsigned int	STEP_MS = 1000,
+						HORIZON = 10,
+						MIN_UPDATES = 30;
+		simple_fan_speed_th	fallback_;
+		rls3			temp_,
+					fan_;
+		unsigned int		acc_ms_,
+					updates_;
+		double			sum_t_,
+					sum_f_,
+					sum_p_,
+					prev_t_,
+					prev_f_,
+					prev_p_,
+					bias_t_,
+					bias_f_;
+		over_cap		cap_;
+
+		// t[n+1] = a*t[n] + b*pwr[n] + c
+		// fan[n+1] = a*fan[n] + b*t[n] + c
+		void learn(const data& d) {
+			acc_ms_ += d.elapsed_ms;
+			sum_t_ += 1.0*d.gpu_temp*d.elapsed_ms;
+			sum_f_ += 1.0*d.fan_speed*d.elapsed_ms;
+			sum_p_ += d.gpu_pwr/1000.0*d.elapsed_ms;
+			if(acc_ms_ < STEP_MS)
+				return;
+			const double	t = sum_t_/acc_ms_,
+			      		f = sum_f_/acc_ms_,
+			      		p = sum_p_/acc_ms_;
+			if(prev_t_ >= 0.0) {
+				const double	x_t[3] = { prev_t_, prev_p_, 1.0 },
+				      		x_f[3] = { prev_f_, prev_t_, 1.0 },
+				      		ALPHA = 0.3;
+				// the model hardly learns when readings are
+				// steady, hence track its steady state error
+				// which is then added to predictions
+				bias_t_ = (1.0 - ALPHA)*bias_t_ + ALPHA*(t - (temp_[0]*x_t[0] + temp_[1]*x_t[1] + temp_[2]));
+				bias_f_ = (1.0 - ALPHA)*bias_f_ + ALPHA*(f - (fan_[0]*x_f[0] + fan_[1]*x_f[1] + fan_[2]));
+				temp_.update(x_t, t);
+				fan_.update(x_f, f);
+				++updates_;
+			}
+			prev_t_ = t;
+			prev_f_ = f;
+			prev_p_ = p;
+			acc_ms_ = 0;
+			sum_t_ = sum_f_ = sum_p_ = 0.0;
+		}
+
+		bool valid_model(void) const {
+			return updates_ >= MIN_UPDATES && temp_[0] > 0.0 && temp_[0] < 1.0 && temp_[1] > 0.0
+				&& fan_[0] >= 0.0 && fan_[0] < 1.0;
+		}
+
+		// highest power (W) keeping both temperature and
+		// fan speed under target after HORIZON steps,
+		// assuming the GPU draws all the power allowed
+		double max_power(const data& d) const {
+			const double	t_max = mgt_ - 0.5 - bias_t_,
+			      		f_max = mfs_ - 0.5 - bias_f_;
+			// fan speed is linear in the power, hence
+			// predict with 0W and 1W to get its gain
+			double		t0 = d.gpu_temp,
+					t1 = d.gpu_temp,
+					f0 = d.fan_speed,
+					f1 = d.fan_speed,
+					a_k = 1.0;
+			for(unsigned int k = 0; k < HORIZON; ++k) {
+				f0 = fan_[0]*f0 + fan_[1]*t0 + fan_[2];
+				f1 = fan_[0]*f1 + fan_[1]*t1 + fan_[2];
+				t0 = temp_[0]*t0 + temp_[2];
+				t1 = temp_[0]*t1 + temp_[1] + temp_[2];
+				a_k *= temp_[0];
+			}
+			// t after HORIZON steps is a^H*t + (b*u + c)*S
+			const double	s_h = (1.0 - a_k)/(1.0 - temp_[0]);
+			double		u = ((t_max - a_k*d.gpu_temp)/s_h - temp_[2])/temp_[1];
+			if(f1 - f0 > 0.0) {
+				const double	u_f = (f_max - f0)/(f1 - f0);
+				if(u_f < u)
+					u = u_f;
+			}
+			return u;
+		}
+	public:
+		mpc_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), verbose_(p.verbose), fallback_(p),
+			temp_(0.98, 100.0, 0.95, 0.01, 1.5), fan_(0.98, 100.0, 0.9, 0.1, 0.0), acc_ms_(0), updates_(0),
+			sum_t_(0.0), sum_f_(0.0), sum_p_(0.0), prev_t_(-1.0), prev_f_(0.0), prev_p_(0.0), bias_t_(0.0), bias_f_(0.0) {
+		}
+
+		// both models with their covariances
+		virtual std::string save(void) const {
+			if(!valid_model())
+				return "";
+			std::ostringstream	oss;
+			oss.precision(10);
+			temp_.save(oss);
+			fan_.save(oss);
+			oss << bias_t_ << " " << bias_f_;
+			return oss.str();
+		}
+
+		virtual bool load(const std::string& s) {
+			std::istringstream	iss(s);
+			if(!temp_.load(iss) || !fan_.load(iss) || !(iss >> bias_t_ >> bias_f_))
+				return false;
+			updates_ = MIN_UPDATES;
+			return valid_model();
+		}
+
+		// the learnt model doesn't depend on the targets
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return fallback_.retarget(max_fan_speed, max_gpu_temp);
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			learn(d);
+			if(!valid_model())
+				return fallback_.check(d, bump_factor);
+			double	u = 1000.0*max_power(d);
+			// fan curves are far from linear, hence
+			// also react once already over target
+			cap_.apply(d, mfs_, mgt_, rps_, u);
+			if(u > d.max_pwr_limit)
+				u = d.max_pwr_limit;
+			else if(u < d.min_pwr_limit)
+				u = d.min_pwr_limit;
+			if(verbose_)
+				std::cerr << __FUNCTION__ << " temp: " << temp_[0] << "," << temp_[1] << "," << temp_[2] << "\tfan: " << fan_[0] << "," << fan_[1] << "," << fan_[2]
+					  << "\tu: " << u << std::endl;
+			return to_action(d, u, bump_factor);
+		}
+	};
+
+
+	// looks for the power limit giving the most work per
+	// joule, work being SM clock times utilization: the
+	// limit range is narrowed by golden-section search,
+	// measuring each probed limit for a few seconds once
+	// settled. The best limit is then held until the
+	// efficiency drifts (i.e. the workload changed) or
+	// every few minutes, when the search starts again.
+	// Fan speed and temperature targets are enforced on
+	// top, as 'mpc' does
+	class ppw_th : public ctrl::throttle {
+		enum phase {
+			SEARCH = 0,
+			HOLD
+		};
+
+		unsigned int		mfs_,
+					mgt_;
+		const unsigned int	rps_;
+		const bool		verbose_;
+		static const unsigned int	SETTLE_MS = 1000,
+						MEASURE_MS = 2000,
+						REPROBE_MS = 300000,
+						TOL_MW = 10000,
+						MIN_UTIL = 10,
+						MAX_DRIFTS = 2;
+		phase			ph_;
+		bool			init_,
+					has1_,
+					has2_;
+		// search interval and its two
+		// inner points, in mW
+		double			a_,
+					b_,
+					x1_,
+					x2_,
+					f1_,
+					f2_,
+					best_,
+					ref_,
+					work_,
+					energy_;
+		unsigned int		meas_ms_,
+					hold_ms_,
+					drifts_;
+		over_cap		cap_;
+
+		void reset_window(void) {
+			meas_ms_ = 0;
+			work_ = energy_ = 0.0;
+		}
+
+		void start_search(const data& d) {
+			const double	R = 0.618034;
+			ph_ = SEARCH;
+			a_ = d.min_pwr_limit;
+			b_ = d.max_pwr_limit;
+			x1_ = b_ - R*(b_ - a_);
+			x2_ = a_ + R*(b_ - a_);
+			has1_ = has2_ = false;
+			reset_window();
+		}
+
+		// MHz/W of the current window, when
+		// complete; idle time isn't measured
+		bool measure(const data& d, double& m) {
+			if(d.gpu_util < MIN_UTIL) {
+				reset_window();
+				return false;
+			}
+			meas_ms_ += d.elapsed_ms;
+			if(meas_ms_ <= SETTLE_MS)
+				return false;
+			work_ += 1.0*d.sm_clock*d.gpu_util/100.0*d.elapsed_ms;
+			energy_ += d.gpu_pwr/1000.0*d.elapsed_ms;
+			if(meas_ms_ < SETTLE_MS + MEASURE_MS)
+				return false;
+			m = (energy_ > 0.0) ? work_/energy_ : 0.0;
+			reset_window();
+			return true;
+		}
+
+		void search(const data& d, const double m) {
+			const double	R = 0.618034,
+			      		EPS = 0.01;
+			if(!has1_) {
+				f1_ = m;
+				has1_ = true;
+			} else {
+				f2_ = m;
+				has2_ = true;
+			}
+			if(!has1_ || !has2_)
+				return;
+			// ties go to the higher limit, so that
+			// a limit which isn't binding stays high
+			const bool	lower = f1_ > f2_*(1.0 + EPS);
+			if(b_ - a_ < TOL_MW) {
+				best_ = lower ? x1_ : x2_;
+				ref_ = lower ? f1_ : f2_;
+				ph_ = HOLD;
+				hold_ms_ = drifts_ = 0;
+				if(verbose_)
+					std::cerr << __FUNCTION__ << " best limit: " << best_ << "mW (" << ref_ << " MHz/W)" << std::endl;
+			} else if(lower) {
+				b_ = x2_;
+				x2_ = x1_;
+				f2_ = f1_;
+				x1_ = b_ - R*(b_ - a_);
+				has1_ = false;
+			} else {
+				a_ = x1_;
+				x1_ = x2_;
+				f1_ = f2_;
+				x2_ = a_ + R*(b_ - a_);
+				has2_ = false;
+			}
+		}
+
+		void hold(const data& d, const bool done, const double m) {
+			const double	DRIFT = 0.1;
+			hold_ms_ += d.elapsed_ms;
+			if(done)
+				drifts_ = (std::fabs(m - ref_) > DRIFT*ref_) ? drifts_ + 1 : 0;
+			if(drifts_ >= MAX_DRIFTS || hold_ms_ >= REPROBE_MS) {
+				if(verbose_)
+					std::cerr << __FUNCTION__ << " searching again" << std::endl;
+				start_search(d);
+			}
+		}
+	public:
+		ppw_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), verbose_(p.verbose),
+			ph_(SEARCH), init_(false), has1_(false), has2_(false), a_(0.0), b_(0.0), x1_(0.0), x2_(0.0), f1_(0.0), f2_(0.0),
+			best_(0.0), ref_(0.0), work_(0.0), energy_(0.0), meas_ms_(0), hold_ms_(0), drifts_(0) {
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
+		}
+
+		virtual bool needs_perf(void) const {
+			return true;
+		}
+
+		// the best limit found, held until the
+		// efficiency drifts
+		virtual std::string save(void) const {
+			if(ph_ != HOLD)
+				return "";
+			std::ostringstream	oss;
+			oss.precision(10);
+			oss << best_ << " " << ref_;
+			return oss.str();
+		}
+
+		virtual bool load(const std::string& s) {
+			std::istringstream	iss(s);
+			double			best = 0.0,
+						ref = 0.0;
+			if(!(iss >> best >> ref) || best <= 0.0 || ref <= 0.0)
+				return false;
+			best_ = best;
+			ref_ = ref;
+			ph_ = HOLD;
+			init_ = true;
+			hold_ms_ = drifts_ = 0;
+			reset_window();
+			return true;
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			double	u = d.max_pwr_limit;
+			// boards not reporting clocks are
+			// only kept under target
+			if(d.sm_clock) {
+				if(!init_) {
+					start_search(d);
+					init_ = true;
+				}
+				double		m = 0.0;
+				const bool	done = measure(d, m);
+				if(ph_ == SEARCH && done)
+					search(d, m);
+				else if(ph_ == HOLD)
+					hold(d, done, m);
+				u = (ph_ == HOLD) ? best_ : (has1_ ? x2_ : x1_);
+			}
+			// samples taken under the cap don't
+			// tell anything about the probed limit
+			if(cap_.apply(d, mfs_, mgt_, rps_, u))
+				reset_window();
+			if(u > d.max_pwr_limit)
+				u = d.max_pwr_limit;
+			else if(u < d.min_pwr_limit)
+				u = d.min_pwr_limit;
+			return to_action(d, u, bump_factor);
+		}
+	};
+
+	// picks every sample the lowest of the power limits
+	// requested by a set of constraints, each with its own
+	// controller: fan speed and temperatures integrate their
+	// error starting from the limit actually applied, hence
+	// the ones not binding don't wind up and hand over
+	// bumplessly; only the binding one adds the proportional
+	// term, as taking the min of all the kicks on integer
+	// readings would only ever lower the limit. Power is a
+	// plain cap
+	class multi_th : public ctrl::throttle {
+		struct ctl {
+			ctrl::constraint	c;
+			double			prev_e,
+						de;
+			bool			init;
+		};
+
+		// the first two are max fan
+		// speed and max temperature
+		std::vector<ctl>	ctls_;
+		// gains are per mW
+		const double		kp_,
+					ki_;
+		const bool		verbose_;
+		int			binding_;
+		// the limit asked for, steps below
+		// PWR_DELTA are kept here
+		double			u_;
+
+		static ctl make(const ctrl::constraint::signal sig, const unsigned int max) {
+			ctl	c;
+			c.c.sig = sig;
+			c.c.max = max;
+			c.prev_e = c.de = 0.0;
+			c.init = false;
+			return c;
+		}
+	public:
+		multi_th(const ctrl::params& p) : kp_(p.pid_kp*1000.0), ki_(p.pid_ki*1000.0), verbose_(p.verbose), binding_(-1), u_(-1.0) {
+			ctls_.push_back(make(ctrl::constraint::FAN, p.max_fan_speed));
+			ctls_.push_back(make(ctrl::constraint::TEMP, p.max_gpu_temp));
+			for(const auto& c : p.constraints)
+				ctls_.push_back(make(c.sig, c.max));
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			ctls_[0].c.max = max_fan_speed;
+			ctls_[1].c.max = max_gpu_temp;
+			return true;
+		}
+
+		virtual std::string binding(void) const {
+			return (binding_ < 0) ? "" : ctrl::to_string(ctls_[binding_].c);
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			const double	dt = d.elapsed_ms/1000.0;
+			double		u = d.max_pwr_limit;
+			int		b = -1;
+			// i.e. first sample, warm start or
+			// limits changed
+			if(std::fabs(u_ - d.pwr_limit) >= ctrl::PWR_DELTA)
+				u_ = d.pwr_limit;
+			for(size_t i = 0; i < ctls_.size(); ++i) {
+				auto&		c = ctls_[i];
+				unsigned int	v = 0;
+				switch(c.c.sig) {
+				case ctrl::constraint::FAN:
+					v = d.fan_speed;
+					break;
+				case ctrl::constraint::TEMP:
+					v = d.gpu_temp;
+					break;
+				case ctrl::constraint::MEM_TEMP:
+					v = d.mem_temp;
+					break;
+				case ctrl::constraint::PWR:
+				default:
+					break;
+				}
+				double		u_c = c.c.max;
+				if(c.c.sig != ctrl::constraint::PWR) {
+					// not reported by this board
+					if(!v)
+						continue;
+					// centered between two integer
+					// readings, as 'pid' does
+					const double	e = 1.0*c.c.max - v - 0.5;
+					u_c = u_ + ki_*e*dt;
+					c.de = c.init ? e - c.prev_e : 0.0;
+					c.prev_e = e;
+					c.init = true;
+				}
+				if(u_c < u) {
+					u = u_c;
+					b = i;
+				}
+			}
+			if(b >= 0 && ctls_[b].c.sig != ctrl::constraint::PWR)
+				u += kp_*ctls_[b].de;
+			if(u > d.max_pwr_limit)
+				u = d.max_pwr_limit;
+			else if(u < d.min_pwr_limit)
+				u = d.min_pwr_limit;
+			if(b != binding_ && verbose_)
+				std::cerr << __FUNCTION__ << " binding constraint: '" << ((b < 0) ? std::string("none") : ctrl::to_string(ctls_[b].c)) << "'" << std::endl;
+			binding_ = b;
+			if(dt <= 0.0)
+				return ctrl::action::PWR_CNST;
+			u_ = u;
+			return to_action(d, u, bump_factor);
+		}
+	};
+
+	// looks for the lowest limit keeping the p99 frame time
+	// under target: the limit goes down in small steps while
+	// frames are well within target, waiting for the window
+	// to refresh after each one, and up at once on a miss,
+	// proportionally to the cube of the excess (dynamic power
+	// vs clock). The limit of the last miss is a floor, slowly
+	// lowered so that lighter scenes get probed again. Without
+	// frame times the limit goes back to max; fan speed and
+	// temperature are hard ceilings, as in 'ppw'
+	class frame_th : public ctrl::throttle {
+		unsigned int		mfs_,
+					mgt_;
+		const unsigned int	rps_,
+		      			tgt_us_;
+		const bool		verbose_;
+		static const unsigned int	DEC_HOLD_MS = 2*ctrl::FRAME_WINDOW_MS,
+						INC_HOLD_MS = ctrl::FRAME_WINDOW_MS,
+						MIN_INC_MW = 5000,
+						FLOOR_MARGIN_MW = 2000,
+						FLOOR_DECAY_MW_S = 50;
+		// the limit asked for and the
+		// lowest one known to hold
+		double			u_,
+					floor_;
+		unsigned int		hold_ms_;
+		bool			capping_;
+		over_cap		cap_;
+	public:
+		frame_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), tgt_us_(p.frame_target_us),
+			verbose_(p.verbose), u_(-1.0), floor_(0.0), hold_ms_(0), capping_(false) {
+			if(!tgt_us_)
+				throw std::runtime_error("'frame' fan control requires a frame time target");
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
+		}
+
+		virtual std::string binding(void) const {
+			if(capping_)
+				return "fan/temp";
+			return (floor_ > 0.0) ? "frame<=" + std::to_string(tgt_us_/1000) + "." + std::to_string(tgt_us_/100%10) + "ms" : "";
+		}
+
+		// the floor, as the limit to start from
+		virtual std::string save(void) const {
+			if(floor_ <= 0.0)
+				return "";
+			std::ostringstream	oss;
+			oss.precision(10);
+			oss << floor_;
+			return oss.str();
+		}
+
+		virtual bool load(const std::string& s) {
+			std::istringstream	iss(s);
+			double			fl = 0.0;
+			if(!(iss >> fl) || fl <= 0.0)
+				return false;
+			floor_ = fl;
+			return true;
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			// i.e. first sample, warm start, capped
+			// or limits changed
+			if(std::fabs(u_ - d.pwr_limit) >= ctrl::PWR_DELTA)
+				u_ = d.pwr_limit;
+			hold_ms_ += d.elapsed_ms;
+			if(floor_ > 0.0)
+				floor_ -= 1.0*FLOOR_DECAY_MW_S*d.elapsed_ms/1000.0;
+			if(!d.frame_us) {
+				u_ = d.max_pwr_limit;
+				floor_ = 0.0;
+			} else if(d.frame_us > tgt_us_) {
+				if(hold_ms_ >= INC_HOLD_MS) {
+					const double	r = 1.0*d.frame_us/tgt_us_;
+					double		inc = 0.7*u_*(r*r*r - 1.0);
+					if(inc < MIN_INC_MW)
+						inc = MIN_INC_MW;
+					else if(inc > 0.25*u_)
+						inc = 0.25*u_;
+					if(floor_ < d.pwr_limit + FLOOR_MARGIN_MW)
+						floor_ = d.pwr_limit + FLOOR_MARGIN_MW;
+					u_ += inc;
+					hold_ms_ = 0;
+					if(verbose_)
+						std::cerr << __FUNCTION__ << " p99 frame time " << d.frame_us << "us over target, floor " << floor_ << "mW" << std::endl;
+				}
+			} else if(d.frame_us < 0.93*tgt_us_ && hold_ms_ >= DEC_HOLD_MS && u_ > floor_) {
+				// smaller steps the closer to target
+				const double	r = 1.0*d.frame_us/tgt_us_;
+				double		dec = 0.3*u_*(1.0 - r*r*r);
+				if(dec > 0.05*u_)
+					dec = 0.05*u_;
+				if(dec < ctrl::PWR_DELTA)
+					dec = ctrl::PWR_DELTA;
+				u_ -= dec;
+				if(u_ < floor_)
+					u_ = floor_;
+				hold_ms_ = 0;
+			}
+			if(u_ > d.max_pwr_limit)
+				u_ = d.max_pwr_limit;
+			else if(u_ < d.min_pwr_limit)
+				u_ = d.min_pwr_limit;
+			double	u = u_;
+			capping_ = cap_.apply(d, mfs_, mgt_, rps_, u);
+			return to_action(d, u, bump_factor);
+		}
+	};
+
+	// drives the fans too, treating noise and performance
+	// as one problem (split range control): a single PI on
+	// the temperature, against a degree below the max one,
+	// moves along a range whose first half runs the fans
+	// from their min speed up to max fan speed (the acoustic
+	// budget) at the max limit, and whose second half lowers
+	// the limit with the fans at the budget. Hence power is
+	// taken only once the fans can't do more and, when the
+	// headroom returns, the limit gets back to max before
+	// the fans slow down. Reaching the max temperature skips
+	// to the power range, as the fans take seconds to spin
+	// up. The temperature is held just under target with the
+	// fans at the budget, instead of capping power where the
+	// firmware fan curve gets to it
+	class joint_th : public ctrl::throttle {
+		unsigned int			mfs_,
+						mgt_;
+		const unsigned int		rps_;
+		static const unsigned int	MIN_FAN = 30,
+						FAN_SLACK = 2;
+		// integral term, 0-1 fan speed range
+		// and 1-2 power limit range, -1 until
+		// the first sample
+		double				v_,
+						slope_;
+		int				fan_;
+		unsigned int			prev_temp_;
+		bool				capping_;
+		over_cap			cap_;
+	public:
+		joint_th(const ctrl::params& p) : mfs_(p.max_fan_speed), mgt_(p.max_gpu_temp), rps_(p.rep_per_second), v_(-1.0), slope_(0.0), fan_(-1), prev_temp_(0), capping_(false) {
+		}
+
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			mfs_ = max_fan_speed;
+			mgt_ = max_gpu_temp;
+			return true;
+		}
+
+		virtual std::string binding(void) const {
+			if(capping_)
+				return "fan/temp";
+			return (v_ > 1.0) ? "fan<=" + std::to_string(mfs_) : "";
+		}
+
+		virtual bool drives_fans(void) const {
+			return true;
+		}
+
+		virtual int fan_target(void) const {
+			return fan_;
+		}
+
+		virtual ctrl::action check(const data& d, float& bump_factor) {
+			// %/C, %/(C*s), mW/C and mW/(C*s), for a
+			// thermal time constant of about 30s
+			const double	FAN_KP = 10.0,
+			      		FAN_KI = 1.0,
+					PWR_KP = 8000.0,
+					PWR_KI = 250.0,
+					LEAD_S = 10.0,
+					SLOPE_S = 4.0;
+			const double	dt = d.elapsed_ms/1000.0,
+			      		fan_min = (MIN_FAN < mfs_) ? MIN_FAN : mfs_,
+					fan_span = (mfs_ > fan_min) ? mfs_ - fan_min : 1.0,
+					pwr_span = (d.max_pwr_limit > d.min_pwr_limit) ? 1.0*d.max_pwr_limit - d.min_pwr_limit : 1.0,
+					err = 1.0*d.gpu_temp - (1.0*mgt_ - 1.0);
+			// the proportional term looks ahead along
+			// the smoothed temperature slope (C/s)
+			if(prev_temp_ && dt > 0.0)
+				slope_ += ((1.0*d.gpu_temp - prev_temp_)/dt - slope_)*((dt < SLOPE_S) ? dt/SLOPE_S : 1.0);
+			prev_temp_ = d.gpu_temp;
+			const double	err_p = err + LEAD_S*slope_;
+			// takes over from where the firmware and
+			// the limit are
+			if(v_ < 0.0) {
+				v_ = (d.pwr_limit < d.max_pwr_limit) ? 1.0 + (1.0*d.max_pwr_limit - d.pwr_limit)/pwr_span : (1.0*d.fan_speed - fan_min)/fan_span;
+				v_ = (v_ < 0.0) ? 0.0 : (v_ > 2.0) ? 2.0 : v_;
+			}
+			// at the max temperature power is taken right
+			// away, with the fans sent to the budget,
+			// instead of waiting for them to spin up
+			const bool	hot = d.gpu_temp >= mgt_;
+			if(hot && v_ < 1.0)
+				v_ = 1.0;
+			// integrates in the range it is in; the fans
+			// spin up slowly hence power is taken only
+			// once they actually got to the budget
+			const bool	in_pwr = v_ > 1.0 || (v_ >= 1.0 && err > 0.0);
+			if(in_pwr) {
+				if(v_ > 1.0 || hot || d.fan_speed + FAN_SLACK >= mfs_)
+					v_ += PWR_KI*err*dt/pwr_span;
+			} else {
+				v_ += FAN_KI*err*dt/fan_span;
+			}
+			v_ = (v_ < 0.0) ? 0.0 : (v_ > 2.0) ? 2.0 : v_;
+			// the proportional term doesn't cross
+			// into the other range
+			double		v = v_ + (in_pwr ? PWR_KP*err_p/pwr_span : FAN_KP*err_p/fan_span);
+			if(in_pwr)
+				v = (v < 1.0) ? 1.0 : (v > 2.0) ? 2.0 : v;
+			else
+				v = (v < 0.0) ? 0.0 : (v > 1.0) ? 1.0 : v;
+			fan_ = static_cast<int>(fan_min + ((v < 1.0) ? v : 1.0)*fan_span + 0.5);
+			double		u = (v > 1.0) ? d.max_pwr_limit - (v - 1.0)*pwr_span : d.max_pwr_limit;
+			capping_ = cap_.apply(d, mfs_, mgt_, rps_, u);
+			return to_action(d, u, bump_factor);
+		}
+	};
+}
+
+ctrl::constraint ctrl::parse_constraint(const std::string& s) {
+	const size_t		le = s.find("<=");
+	const std::string	sig = s.substr(0, le),
+	      			v = (le == std::string::npos) ? "" : s.substr(le + 2);
+	constraint		c;
+	char			*end = 0;
+	const long		n = std::strtol(v.c_str(), &end, 10);
+	bool			ok = !v.empty() && end != v.c_str() && n > 0;
+	if(sig == "fan") {
+		c.sig = constraint::FAN;
+		ok = ok && !*end && n <= 100;
+	} else if(sig == "temp" || sig == "mem_temp") {
+		c.sig = (sig == "temp") ? constraint::TEMP : constraint::MEM_TEMP;
+		ok = ok && !*end && n <= 150;
+	} else if(sig == "power") {
+		// in W, the unit is optional
+		c.sig = constraint::PWR;
+		ok = ok && (!*end || !std::strcmp(end, "W"));
+	} else {
+		ok = false;
+	}
+	if(!ok)
+		throw std::runtime_error((std::string("Invalid constraint '") + s + "', valid ones are 'fan<=%', 'temp<=C', 'mem_temp<=C' and 'power<=W'").c_str());
+	c.max = (c.sig == constraint::PWR) ? n*1000 : n;
+	return c;
+}
+
+std::string ctrl::to_string(const ctrl::constraint& c) {
+	switch(c.sig) {
+	case constraint::FAN:
+		return "fan<=" + std::to_string(c.max);
+	case constraint::TEMP:
+		return "temp<=" + std::to_string(c.max);
+	case constraint::MEM_TEMP:
+		return "mem_temp<=" + std::to_string(c.max);
+	case constraint::PWR:
+	default:
+		break;
+	}
+	return "power<=" + std::to_string(c.max/1000) + "W";
+}
+
+unsigned int ctrl::apply_action(const ctrl::action a, const float bump_factor, const unsigned int cur_limit, const unsigned int min_limit, const unsigned int max_limit) {
+	switch(a) {
+	case ctrl::action::PWR_DEC: {
+		long long	tgt = cur_limit - static_cast<long long>(bump_factor*PWR_DELTA);
+		// if we're lesser than the barrier, reset
+		if(tgt < min_limit)
+			tgt = min_limit;
+		return tgt;
+	} break;
+
+	case ctrl::action::PWR_INC: {
+		if(cur_limit >= max_limit)
+			return cur_limit;
+		long long	tgt = cur_limit + static_cast<long long>(bump_factor*PWR_DELTA);
+		if(tgt > max_limit)
+			tgt = max_limit;
+		return tgt;
+	} break;
+
+	case ctrl::action::PWR_CNST:
+	default:
+		break;
+	}
+	return cur_limit;
 }
 
 ctrl::throttle* ctrl::get_fan_ctrl(const std::string& ctrl_name, const ctrl::params& p) {
@@ -135,6 +1203,18 @@ ctrl::throttle* ctrl::get_fan_ctrl(const std::string& ctrl_name, const ctrl::par
 		return new wavg_fan_speed_th(p);
 	} else if(ctrl_name == "gpu_temp") {
 		return new simple_gpu_temp_th(p);
+	} else if(ctrl_name == "pid") {
+		return new pid_th(p);
+	} else if(ctrl_name == "mpc") {
+		return new mpc_th(p);
+	} else if(ctrl_name == "ppw") {
+		return new ppw_th(p);
+	} else if(ctrl_name == "multi") {
+		return new multi_th(p);
+	} else if(ctrl_name == "frame") {
+		return new frame_th(p);
+	} else if(ctrl_name == "joint") {
+		return new joint_th(p);
 	}
 
 	throw std::runtime_error((std::string("Invalid fan ctrl name specified: \'") + ctrl_name + "\'").c_str());
@@ -19,6 +19,7 @@
 #define _CTRL_H_
 
 #include <string>
+#include <vector>
 
 namespace ctrl {
 	enum action {
@@ -29,22 +30,127 @@ namespace ctrl {
 
 	class throttle {
 	public:
+		// elapsed_ms is the actual time passed
+		// since the previous sample, power values
+		// are in mW; pwr_limit is the current target
+		// which is kept between min_pwr_limit and
+		// max_pwr_limit. sm_clock (MHz) and gpu_util (%)
+		// are 0 unless needs_perf, mem_temp (C) is 0
+		// when the board doesn't report it, frame_us
+		// is the p99 frame time over FRAME_WINDOW_MS,
+		// 0 without frame times
 		struct data {
 			unsigned int	fan_speed,
-					gpu_temp;
+					gpu_temp,
+					elapsed_ms,
+					gpu_pwr,
+					pwr_limit,
+					min_pwr_limit,
+					max_pwr_limit,
+					sm_clock,
+					gpu_util,
+					mem_temp,
+					frame_us;
 		};
 
 		virtual action check(const data& d, float& bump_factor) = 0;
 
+		// what has been learnt (i.e. gains, models)
+		// as text, to warm start another session
+		// with load; empty when there's nothing
+		virtual std::string save(void) const {
+			return "";
+		}
+
+		virtual bool load(const std::string& s) {
+			return false;
+		}
+
+		// the constraint currently limiting the power,
+		// empty when none or not applicable
+		virtual std::string binding(void) const {
+			return "";
+		}
+
+		// whether SM clock and utilization have to
+		// be sampled, which costs 2 more NVML calls
+		virtual bool needs_perf(void) const {
+			return false;
+		}
+
+		// whether fan_target can be set, i.e. the device
+		// has to support setting fan speeds
+		virtual bool drives_fans(void) const {
+			return false;
+		}
+
+		// fan speed (%) to drive the fans to after
+		// check, -1 leaves them to the firmware
+		virtual int fan_target(void) const {
+			return -1;
+		}
+
+		// changes the targets keeping the state, returns
+		// false when not supported (i.e. a new instance
+		// has to be created)
+		virtual bool retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			return false;
+		}
+
 		virtual ~throttle() {
 		}
 	};
 
+	// power limit step (mW) a bump factor of 1 corresponds to
+	// and hard min power limit (mW), when the board doesn't
+	// report its own
+	const unsigned int	PWR_DELTA = 1000,
+				MIN_PWR_LIMIT = 50*1000,
+				FRAME_WINDOW_MS = 1000;
+
+	// returns the new target power limit (mW) after applying
+	// action a, clamped between min_limit and max_limit
+	extern unsigned int apply_action(const action a, const float bump_factor, const unsigned int cur_limit, const unsigned int min_limit, const unsigned int max_limit);
+
+	// an upper bound on one signal, for the 'multi'
+	// fan control; max is in %, C or mW
+	struct constraint {
+		enum signal {
+			FAN = 0,
+			TEMP,
+			MEM_TEMP,
+			PWR
+		};
+
+		signal		sig;
+		unsigned int	max;
+	};
+
+	// i.e. 'fan<=70', 'temp<=78', 'mem_temp<=95' or
+	// 'power<=250W', throws when not valid
+	extern constraint parse_constraint(const std::string& s);
+
+	extern std::string to_string(const constraint& c);
+
+	// rep_per_second is the nominal sampling
+	// rate, used to scale the bump factors;
+	// pid_* are the 'pid' gains (W/C, W/(C*s)
+	// and W*s/C), auto-tuned when pid_tune;
+	// constraints are the ones of 'multi' on
+	// top of max_fan_speed and max_gpu_temp;
+	// frame_target_us is the p99 frame time
+	// 'frame' holds
 	struct params {
 		unsigned int	max_fan_speed,
 				max_gpu_temp,
 				rep_per_second;
-		bool		verbose;
+		bool		verbose,
+				pid_tune;
+		double		pid_kp,
+				pid_ki,
+				pid_kd;
+		std::vector<constraint>	constraints;
+		unsigned int	frame_target_us;
 	};
 
 	extern throttle* get_fan_ctrl(const std::string& ctrl_name, const params& p);
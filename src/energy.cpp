@@ -0,0 +1,66 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#include "energy.h"
+
+namespace {
+	// power within 5% of the limit is capped by it
+	const double	AT_LIMIT = 0.95,
+	      		// how fast the uncapped reference
+	      		// follows lower power (ms)
+	      		REF_TAU_MS = 60000.0;
+}
+
+energy::meter::meter(const unsigned int default_limit) : default_(default_limit), has_last_(false), last_mj_(0), energy_mj_(0.0), saved_mj_(0.0),
+	ref_mw_(default_limit), prev_mw_(0), ms_(0), counter_ms_(0) {
+	for(unsigned int i = 0; i < N_BANDS; ++i)
+		band_ms_[i] = 0;
+}
+
+void energy::meter::add(const unsigned int elapsed_ms, const unsigned int gpu_pwr, const unsigned int pwr_limit, const bool has_counter, const unsigned long long counter_mj) {
+	// a counter going backwards (i.e. driver
+	// reloaded) falls back to integrating
+	if(has_counter && has_last_ && counter_mj >= last_mj_) {
+		energy_mj_ += counter_mj - last_mj_;
+		counter_ms_ += elapsed_ms;
+	} else {
+		// trapezoids, as power ramps between samples
+		energy_mj_ += 0.5*(gpu_pwr + (ms_ ? prev_mw_ : gpu_pwr))*elapsed_ms/1000.0;
+	}
+	prev_mw_ = gpu_pwr;
+	has_last_ = has_counter;
+	last_mj_ = counter_mj;
+	ms_ += elapsed_ms;
+	unsigned int	band = default_ ? static_cast<unsigned int>(1ULL*pwr_limit*N_BANDS/default_) : N_BANDS - 1;
+	if(band >= N_BANDS)
+		band = N_BANDS - 1;
+	band_ms_[band] += elapsed_ms;
+	const bool	capped = gpu_pwr >= AT_LIMIT*pwr_limit;
+	if(capped && pwr_limit < default_) {
+		const double	est = (ref_mw_ < default_) ? ref_mw_ : default_;
+		if(est > gpu_pwr)
+			saved_mj_ += (est - gpu_pwr)*elapsed_ms/1000.0;
+	} else if(capped) {
+		ref_mw_ = default_;
+	} else if(gpu_pwr >= ref_mw_) {
+		ref_mw_ = gpu_pwr;
+	} else {
+		const double	a = (elapsed_ms < REF_TAU_MS) ? elapsed_ms/REF_TAU_MS : 1.0;
+		ref_mw_ += a*(gpu_pwr - ref_mw_);
+	}
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef _ENERGY_H_
+#define _ENERGY_H_
+
+#include <stdint.h>
+
+namespace energy {
+	// power limit bands, each a tenth of the default limit
+	const unsigned int	N_BANDS = 10;
+
+	// energy drawn by a device over the session and an
+	// estimate of what it would have drawn at the default
+	// power limit. The board energy counter is used when
+	// available, else power is integrated over the actual
+	// time between samples. While the power is at a limit
+	// below the default one, the GPU is assumed to otherwise
+	// draw as much as the last time it wasn't capped (the
+	// default limit when it has always been)
+	class meter {
+		const unsigned int	default_;
+		bool			has_last_;
+		unsigned long long	last_mj_;
+		double			energy_mj_,
+					saved_mj_,
+					ref_mw_;
+		unsigned int		prev_mw_;
+		uint64_t		ms_,
+					counter_ms_,
+					band_ms_[N_BANDS];
+	public:
+		meter(const unsigned int default_limit);
+
+		// elapsed_ms is the time since the previous sample,
+		// power values are in mW; counter_mj is the board
+		// total energy counter when has_counter
+		void add(const unsigned int elapsed_ms, const unsigned int gpu_pwr, const unsigned int pwr_limit, const bool has_counter, const unsigned long long counter_mj);
+
+		double energy_mj(void) const {
+			return energy_mj_;
+		}
+
+		double saved_mj(void) const {
+			return saved_mj_;
+		}
+
+		uint64_t ms(void) const {
+			return ms_;
+		}
+
+		// time measured through the board counter
+		uint64_t counter_ms(void) const {
+			return counter_ms_;
+		}
+
+		// time spent with the power limit between
+		// i and i+1 tenths of the default one
+		uint64_t band_ms(const unsigned int i) const {
+			return band_ms_[i];
+		}
+	};
+}
+
+#endif //_ENERGY_H_
@@ -0,0 +1,188 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "filt.h"
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+	class ewma : public filt::filter {
+		const double	tau_ms_;
+		bool		init_;
+		double		y_;
+	public:
+		ewma(const double tau_ms) : tau_ms_(tau_ms), init_(false), y_(0.0) {
+		}
+
+		virtual double update(const double x, const unsigned int dt_ms) {
+			if(!init_) {
+				init_ = true;
+				return y_ = x;
+			}
+			// irregular sampling: the weight of the new
+			// sample grows with the time it covers
+			y_ += (1.0 - std::exp(-1.0*dt_ms/tau_ms_))*(x - y_);
+			return y_;
+		}
+	};
+
+	class median : public filt::filter {
+		const size_t		n_;
+		std::vector<double>	ring_,
+					sorted_;
+		size_t			pos_;
+	public:
+		median(const size_t n) : n_(n), pos_(0) {
+			ring_.reserve(n);
+			sorted_.reserve(n);
+		}
+
+		virtual double update(const double x, const unsigned int dt_ms) {
+			// sorted_ holds the same values as ring_,
+			// the oldest one gets replaced in place
+			if(ring_.size() < n_) {
+				ring_.push_back(x);
+				sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), x), x);
+			} else {
+				sorted_.erase(std::lower_bound(sorted_.begin(), sorted_.end(), ring_[pos_]));
+				sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), x), x);
+				ring_[pos_] = x;
+				pos_ = (pos_ + 1)%n_;
+			}
+			return sorted_[sorted_.size()/2];
+		}
+	};
+
+	class rate : public filt::filter {
+		const double	max_per_s_;
+		bool		init_;
+		double		y_;
+	public:
+		rate(const double max_per_s) : max_per_s_(max_per_s), init_(false), y_(0.0) {
+		}
+
+		virtual double update(const double x, const unsigned int dt_ms) {
+			if(!init_) {
+				init_ = true;
+				return y_ = x;
+			}
+			const double	max_d = max_per_s_*dt_ms/1000.0;
+			y_ += std::max(-max_d, std::min(max_d, x - y_));
+			return y_;
+		}
+	};
+
+	class kalman : public filt::filter {
+		const double	q_,
+				r_;
+		bool		init_;
+		double		x_,
+				p_;
+	public:
+		kalman(const double q, const double r) : q_(q), r_(r), init_(false), x_(0.0), p_(0.0) {
+		}
+
+		virtual double update(const double z, const unsigned int dt_ms) {
+			if(!init_) {
+				init_ = true;
+				p_ = r_;
+				return x_ = z;
+			}
+			// random walk model: predict, then correct
+			p_ += q_*dt_ms/1000.0;
+			const double	k = p_/(p_ + r_);
+			x_ += k*(z - x_);
+			p_ *= 1.0 - k;
+			return x_;
+		}
+	};
+
+	double get_arg(const std::vector<std::string>& args, const size_t i, const double min_v, const std::string& spec) {
+		char		*end = 0;
+		const double	v = (i < args.size()) ? std::strtod(args[i].c_str(), &end) : 0.0;
+		if(i >= args.size() || args[i].empty() || *end || !(v >= min_v))
+			throw std::runtime_error((std::string("Invalid filter '") + spec + "'").c_str());
+		return v;
+	}
+
+	unsigned int run(std::vector<std::unique_ptr<filt::filter>>& stages, const unsigned int x, const unsigned int dt_ms) {
+		if(stages.empty())
+			return x;
+		double	y = x;
+		for(auto& s : stages)
+			y = s->update(y, dt_ms);
+		return (y > 0.0) ? static_cast<unsigned int>(std::lround(y)) : 0;
+	}
+}
+
+filt::filter* filt::get_filter(const std::string& spec) {
+	std::vector<std::string>	args;
+	std::istringstream		iss(spec);
+	std::string			a;
+	while(std::getline(iss, a, ':'))
+		args.push_back(a);
+	const std::string		name = args.empty() ? "" : args[0];
+	if(name == "ewma" && args.size() == 2) {
+		return new ewma(get_arg(args, 1, 1.0, spec));
+	} else if(name == "median" && args.size() == 2) {
+		const double	n = get_arg(args, 1, 1.0, spec);
+		if(n > MAX_MEDIAN || n != std::floor(n) || !(static_cast<unsigned int>(n) % 2))
+			throw std::runtime_error((std::string("Invalid filter '") + spec + "', median window has to be odd and at most " + std::to_string(MAX_MEDIAN)).c_str());
+		return new median(n);
+	} else if(name == "rate" && args.size() == 2) {
+		return new rate(get_arg(args, 1, 0.001, spec));
+	} else if(name == "kalman" && args.size() == 3) {
+		// with no process noise the gain goes to 0 and
+		// the filter would stick to its first sample
+		const double	q = get_arg(args, 1, 0.0, spec);
+		if(!(q > 0.0))
+			throw std::runtime_error((std::string("Invalid filter '") + spec + "', kalman process noise has to be positive").c_str());
+		return new kalman(q, get_arg(args, 2, 0.001, spec));
+	}
+	throw std::runtime_error((std::string("Invalid filter '") + spec + "'").c_str());
+}
+
+filt::pipeline::pipeline(const std::vector<std::string>& specs) {
+	for(const auto& s : specs) {
+		const size_t		eq = s.find('=');
+		const std::string	sig = s.substr(0, eq);
+		std::vector<std::unique_ptr<filter>>	*stages = 0;
+		if(sig == "fan")
+			stages = &fan_;
+		else if(sig == "temp")
+			stages = &temp_;
+		else if(sig == "pwr")
+			stages = &pwr_;
+		if(!stages || eq == std::string::npos)
+			throw std::runtime_error((std::string("Invalid filter spec '") + s + "', has to be 'fan=...', 'temp=...' or 'pwr=...'").c_str());
+		std::istringstream	iss(s.substr(eq + 1));
+		std::string		f;
+		while(std::getline(iss, f, ','))
+			stages->push_back(std::unique_ptr<filter>(get_filter(f)));
+		if(s.size() == eq + 1)
+			throw std::runtime_error((std::string("Invalid filter spec '") + s + "', no filters given").c_str());
+	}
+}
+
+void filt::pipeline::apply(ctrl::throttle::data& d) {
+	d.fan_speed = run(fan_, d.fan_speed, d.elapsed_ms);
+	d.gpu_temp = run(temp_, d.gpu_temp, d.elapsed_ms);
+	d.gpu_pwr = run(pwr_, d.gpu_pwr, d.elapsed_ms);
+}
@@ -0,0 +1,73 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _FILT_H_
+#define _FILT_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "ctrl.h"
+
+namespace filt {
+	// one stage processing a signal; dt_ms is the
+	// time passed since the previous sample, 0 for
+	// the first one. Each update is O(1) (median
+	// windows are bounded to MAX_MEDIAN)
+	class filter {
+	public:
+		virtual double update(const double x, const unsigned int dt_ms) = 0;
+
+		virtual ~filter() {
+		}
+	};
+
+	const unsigned int	MAX_MEDIAN = 31;
+
+	// 'ewma:tau_ms'    - exponential moving average with time
+	//                    constant tau_ms, accounting for dt
+	// 'median:n'       - median of the latest n samples (odd)
+	// 'rate:r'         - follows the input changing at most
+	//                    r units per second
+	// 'kalman:q:r'     - 1D Kalman filter with process noise q
+	//                    (variance per second) and measurement
+	//                    noise r (variance)
+	// throws on invalid specs
+	extern filter* get_filter(const std::string& spec);
+
+	// filters in front of ctrl::throttle::check, for fan
+	// speed, GPU temperature and power usage; each spec
+	// is 'signal=filter[,filter...]' with signal one of
+	// 'fan', 'temp' and 'pwr', i.e. 'temp=median:5,ewma:2000'
+	// and stages are applied in order
+	class pipeline {
+		std::vector<std::unique_ptr<filter>>	fan_,
+							temp_,
+							pwr_;
+	public:
+		pipeline(const std::vector<std::string>& specs);
+
+		bool empty(void) const {
+			return fan_.empty() && temp_.empty() && pwr_.empty();
+		}
+
+		// replaces the signals in d with the filtered ones
+		void apply(ctrl::throttle::data& d);
+	};
+}
+
+#endif //_FILT_H_
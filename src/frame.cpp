@@ -0,0 +1,237 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#include "frame.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+namespace {
+	const char		*SOCK_PREFIX = "unix:";
+	// frames older than MAX_AGE_MS are dropped, windows
+	// with less than MIN_FRAMES don't give a p99
+	const unsigned int	MAX_AGE_MS = 10000,
+				MIN_FRAMES = 10,
+				MAX_CLIENTS = 8;
+	const size_t		MAX_FRAMES = 20000,
+				MAX_LINE = 4096;
+
+	uint64_t now_ms(void) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	std::string trim(const std::string& s) {
+		const size_t	b = s.find_first_not_of(" \t\r\n"),
+		      		e = s.find_last_not_of(" \t\r\n");
+		return (b == std::string::npos) ? std::string() : s.substr(b, e - b + 1);
+	}
+
+	bool to_double(const std::string& s, double& v) {
+		char	*end = 0;
+		if(s.empty())
+			return false;
+		v = std::strtod(s.c_str(), &end);
+		return end && !*end;
+	}
+
+	// a writer and what it sent after
+	// the last new line
+	struct conn {
+		int		fd;
+		std::string	buf;
+		int		col;
+	};
+}
+
+frame::source::source(const std::string& path) : path_(path.compare(0, std::strlen(SOCK_PREFIX), SOCK_PREFIX) ? path : path.substr(std::strlen(SOCK_PREFIX))),
+	sock_(path_ != path), fd_(-1), efd_(-1) {
+	// games don't run as root, anyone
+	// can send frame times
+	const mode_t	prev_mask = umask(0);
+	int		rv = 0;
+	if(sock_) {
+		struct sockaddr_un	addr;
+		std::memset(&addr, 0x00, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(path_.size() >= sizeof(addr.sun_path)) {
+			umask(prev_mask);
+			throw std::runtime_error((std::string("Frame socket path too long: '") + path_ + "'").c_str());
+		}
+		std::strcpy(addr.sun_path, path_.c_str());
+		unlink(path_.c_str());
+		if(-1 == (fd_ = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0)) || bind(fd_, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) || listen(fd_, MAX_CLIENTS))
+			rv = -1;
+	} else {
+		// opened for writing as well, so that
+		// writers coming and going never
+		// make it hit EOF
+		struct stat	st;
+		if(stat(path_.c_str(), &st)) {
+			if(errno != ENOENT || mkfifo(path_.c_str(), 0622))
+				rv = -1;
+		} else if(!S_ISFIFO(st.st_mode)) {
+			umask(prev_mask);
+			throw std::runtime_error((std::string("Frame source '") + path_ + "' isn't a FIFO").c_str());
+		}
+		if(!rv && -1 == (fd_ = open(path_.c_str(), O_RDWR|O_NONBLOCK|O_CLOEXEC)))
+			rv = -1;
+	}
+	umask(prev_mask);
+	if(rv || -1 == (efd_ = eventfd(0, EFD_CLOEXEC))) {
+		const int	err = errno;
+		if(fd_ >= 0)
+			close(fd_);
+		throw std::runtime_error((std::string("Can't read frame times from '") + path_ + "': " + std::strerror(err)).c_str());
+	}
+	th_ = std::thread(&source::loop, this);
+}
+
+frame::source::~source() {
+	const uint64_t	v = 1;
+	if(write(efd_, &v, sizeof(v))) {
+	}
+	if(th_.joinable())
+		th_.join();
+	close(efd_);
+	close(fd_);
+	if(sock_)
+		unlink(path_.c_str());
+}
+
+unsigned int frame::source::parse(const std::string& line, int& col) {
+	std::vector<std::string>	tok;
+	size_t				b = 0;
+	while(true) {
+		const size_t	e = line.find(',', b);
+		tok.push_back(trim(line.substr(b, (e == std::string::npos) ? std::string::npos : e - b)));
+		if(e == std::string::npos)
+			break;
+		b = e + 1;
+	}
+	if((tok.size() == 1 && tok[0].empty()) || tok[0][0] == '#')
+		return 0;
+	// a header (or any other text line) tells
+	// which column to read, if any
+	double	v = 0.0;
+	for(const auto& t : tok) {
+		if(!to_double(t, v)) {
+			col = -1;
+			for(size_t i = 0; i < tok.size(); ++i)
+				if(tok[i] == "frametime")
+					col = i;
+			return 0;
+		}
+	}
+	if(col < 0 || col >= static_cast<int>(tok.size()) || !to_double(tok[col], v) || !(v > 0.0 && v < 10000.0))
+		return 0;
+	const unsigned int	us = static_cast<unsigned int>(v*1000.0 + 0.5);
+	return us ? us : 1;
+}
+
+void frame::source::loop(void) {
+	std::vector<conn>	conns;
+	if(!sock_)
+		conns.push_back({ fd_, "", 0 });
+	while(true) {
+		std::vector<struct pollfd>	pfd;
+		pfd.push_back({ efd_, POLLIN, 0 });
+		if(sock_)
+			pfd.push_back({ fd_, POLLIN, 0 });
+		for(const auto& c : conns)
+			pfd.push_back({ c.fd, POLLIN, 0 });
+		if(poll(&pfd[0], pfd.size(), -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		if(pfd[0].revents)
+			break;
+		const size_t	first = sock_ ? 2 : 1;
+		std::vector<unsigned int>	us;
+		for(size_t i = 0; i < conns.size(); ++i) {
+			if(!pfd[first + i].revents)
+				continue;
+			conn&		c = conns[i];
+			char		buf[4096];
+			const ssize_t	rv = read(c.fd, buf, sizeof(buf));
+			if(rv < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if(rv <= 0) {
+				// writer gone, only on sockets
+				close(c.fd);
+				c.fd = -1;
+				continue;
+			}
+			c.buf.append(buf, rv);
+			size_t	nl;
+			while((nl = c.buf.find('\n')) != std::string::npos) {
+				const unsigned int	f_us = parse(c.buf.substr(0, nl), c.col);
+				if(f_us)
+					us.push_back(f_us);
+				c.buf.erase(0, nl + 1);
+			}
+			// not a line anyway
+			if(c.buf.size() > MAX_LINE)
+				c.buf.clear();
+		}
+		conns.erase(std::remove_if(conns.begin(), conns.end(), [](const conn& c) { return c.fd < 0; }), conns.end());
+		if(sock_ && pfd[1].revents) {
+			const int	fd = accept4(fd_, 0, 0, SOCK_CLOEXEC|SOCK_NONBLOCK);
+			if(fd >= 0 && conns.size() < MAX_CLIENTS)
+				conns.push_back({ fd, "", 0 });
+			else if(fd >= 0)
+				close(fd);
+		}
+		if(us.empty())
+			continue;
+		const uint64_t			now = now_ms();
+		std::lock_guard<std::mutex>	l(mtx_);
+		for(const auto f_us : us)
+			frames_.push_back({ now, f_us });
+		while(!frames_.empty() && (frames_.size() > MAX_FRAMES || frames_.front().t_ms + MAX_AGE_MS < now))
+			frames_.pop_front();
+	}
+	for(const auto& c : conns)
+		if(c.fd != fd_)
+			close(c.fd);
+}
+
+unsigned int frame::source::p99_us(const unsigned int window_ms) {
+	const uint64_t			now = now_ms();
+	std::vector<unsigned int>	us;
+	{
+		std::lock_guard<std::mutex>	l(mtx_);
+		for(auto it = frames_.rbegin(); it != frames_.rend() && it->t_ms + window_ms >= now; ++it)
+			us.push_back(it->us);
+	}
+	if(us.size() < MIN_FRAMES)
+		return 0;
+	const size_t	idx = (99*us.size() + 99)/100 - 1;
+	std::nth_element(us.begin(), us.begin() + idx, us.end());
+	return us[idx];
+}
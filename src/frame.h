@@ -0,0 +1,67 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+namespace frame {
+	// frame times (ms) sent by a local process, one per line:
+	// either a plain number or CSV with a 'frametime' column
+	// in the header (i.e. a MangoHud log). path is a FIFO,
+	// created if missing, or 'unix:path' for a Unix domain
+	// socket accepting any number of writers. Frames are
+	// read on a dedicated thread
+	class source {
+		struct frame {
+			uint64_t	t_ms;
+			unsigned int	us;
+		};
+
+		const std::string	path_;
+		const bool		sock_;
+		int			fd_,
+					efd_;
+		std::mutex		mtx_;
+		std::deque<frame>	frames_;
+		std::thread		th_;
+
+		void loop(void);
+	public:
+		source(const std::string& path);
+
+		~source();
+
+		// parses a line, returns the frame time in us,
+		// 0 when not a frame; col is the CSV column of
+		// the frame time, updated by headers
+		static unsigned int parse(const std::string& line, int& col);
+
+		// p99 frame time (us) of the frames received in
+		// the last window_ms, 0 when too few to tell
+		unsigned int p99_us(const unsigned int window_ms);
+	};
+}
+
+#endif //_FRAME_H_
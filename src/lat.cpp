@@ -0,0 +1,133 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "lat.h"
+#include <mutex>
+#include <deque>
+#include <cstring>
+#include <cstdio>
+
+thread_local lat::table	*lat::cur = 0;
+
+namespace {
+	// deque, so that references to names
+	// stay valid when adding sites
+	std::mutex		sites_mtx;
+	std::deque<std::string>	sites;
+
+	size_t bucket(uint64_t ns) {
+		using lat::histogram;
+		if(ns < histogram::SUB)
+			return ns;
+		int	msb = 63 - __builtin_clzll(ns);
+		if(msb >= static_cast<int>(histogram::MAX_BIT)) {
+			msb = histogram::MAX_BIT - 1;
+			ns = ~0ULL >> (64 - histogram::MAX_BIT);
+		}
+		return histogram::SUB + (msb - histogram::SUB_BITS)*histogram::SUB + ((ns >> (msb - histogram::SUB_BITS)) & (histogram::SUB - 1));
+	}
+
+	// upper bound of a bucket
+	uint64_t bucket_value(const size_t idx) {
+		using lat::histogram;
+		if(idx < histogram::SUB)
+			return idx;
+		const size_t	shift = (idx - histogram::SUB)/histogram::SUB,
+		      		sub = (idx - histogram::SUB)%histogram::SUB;
+		return ((histogram::SUB + sub + 1) << shift) - 1;
+	}
+
+	std::string fmt_ns(const uint64_t ns) {
+		char	buf[32];
+		if(ns < 10000)
+			std::snprintf(buf, sizeof(buf), "%.1fus", ns/1000.0);
+		else if(ns < 10000000)
+			std::snprintf(buf, sizeof(buf), "%.0fus", ns/1000.0);
+		else if(ns < 10000000000ULL)
+			std::snprintf(buf, sizeof(buf), "%.0fms", ns/1000000.0);
+		else
+			std::snprintf(buf, sizeof(buf), "%.1fs", ns/1000000000.0);
+		return buf;
+	}
+}
+
+lat::histogram::histogram() : n_(0), sum_(0), max_(0) {
+	std::memset(counts_, 0x00, sizeof(counts_));
+}
+
+void lat::histogram::add(const uint64_t ns) {
+	++counts_[bucket(ns)];
+	++n_;
+	sum_ += ns;
+	if(ns > max_)
+		max_ = ns;
+}
+
+uint64_t lat::histogram::percentile(const double p) const {
+	const uint64_t	tgt = static_cast<uint64_t>(p*n_ + 0.5);
+	uint64_t	acc = 0;
+	for(size_t i = 0; i < N_BUCKETS; ++i) {
+		acc += counts_[i];
+		if(acc >= tgt && acc)
+			return (bucket_value(i) < max_) ? bucket_value(i) : max_;
+	}
+	return max_;
+}
+
+size_t lat::site(const char* expr) {
+	// from 'nvml::nvmlDeviceGetName(d.dev, ...)'
+	// only keep 'nvmlDeviceGetName'
+	const char	*b = expr,
+			*e = std::strchr(expr, '(');
+	if(!e)
+		e = expr + std::strlen(expr);
+	for(const char *p = expr; p < e; ++p)
+		if(*p == ':')
+			b = p + 1;
+	if(!std::strncmp(b, "pvt_", 4))
+		b += 4;
+	std::lock_guard<std::mutex>	l(sites_mtx);
+	const std::string		name(b, e);
+	for(size_t i = 0; i < sites.size(); ++i)
+		if(sites[i] == name)
+			return i;
+	sites.push_back(name);
+	return sites.size() - 1;
+}
+
+const std::string& lat::site_name(const size_t id) {
+	std::lock_guard<std::mutex>	l(sites_mtx);
+	return sites[id];
+}
+
+void lat::table::add(const size_t id, const uint64_t ns) {
+	if(id >= h_.size())
+		h_.resize(id + 1);
+	if(!h_[id])
+		h_[id].reset(new histogram());
+	h_[id]->add(ns);
+}
+
+void lat::table::print(std::ostream& os, const std::string& prefix) const {
+	for(size_t i = 0; i < h_.size(); ++i) {
+		if(!h_[i] || !h_[i]->count())
+			continue;
+		const auto&	h = *h_[i];
+		os << prefix << site_name(i) << ": p50 " << fmt_ns(h.percentile(0.5)) << ", p99 " << fmt_ns(h.percentile(0.99))
+		   << ", max " << fmt_ns(h.max()) << ", avg " << fmt_ns(h.sum()/h.count()) << " (" << h.count() << " samples)\n";
+	}
+}
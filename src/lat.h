@@ -0,0 +1,101 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _LAT_H_
+#define _LAT_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include <time.h>
+
+namespace lat {
+	inline uint64_t now_ns(void) {
+		struct timespec	ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+	}
+
+	// log-linear histogram of durations (ns): each power
+	// of 2 is split in 16 buckets, hence values are
+	// within ~6% and recording is a few instructions
+	class histogram {
+	public:
+		static const size_t	SUB_BITS = 4,
+		      			SUB = 1 << SUB_BITS,
+					MAX_BIT = 40, // ~18 minutes
+					N_BUCKETS = SUB + (MAX_BIT - SUB_BITS)*SUB;
+	private:
+		uint64_t	counts_[N_BUCKETS],
+				n_,
+				sum_,
+				max_;
+	public:
+		histogram();
+
+		void add(const uint64_t ns);
+
+		// value (ns) below which fraction p of
+		// the samples falls
+		uint64_t percentile(const double p) const;
+
+		uint64_t count(void) const {
+			return n_;
+		}
+
+		uint64_t sum(void) const {
+			return sum_;
+		}
+
+		uint64_t max(void) const {
+			return max_;
+		}
+	};
+
+	// timed sites (i.e. each NVML call) are registered
+	// once and get an id, names are shared by all threads
+	extern size_t site(const char* expr);
+
+	extern const std::string& site_name(const size_t id);
+
+	// the histograms of all the sites for a thread
+	class table {
+		std::vector<std::unique_ptr<histogram>>	h_;
+	public:
+		void add(const size_t id, const uint64_t ns);
+
+		const histogram* get(const size_t id) const {
+			return (id < h_.size()) ? h_[id].get() : 0;
+		}
+
+		// p50/p99/max of all the sites with samples
+		void print(std::ostream& os, const std::string& prefix) const;
+	};
+
+	// table timed calls get recorded into, per thread;
+	// when null (i.e. during init) timings are skipped
+	extern thread_local table	*cur;
+
+	inline void record(const size_t id, const uint64_t ns) {
+		if(cur)
+			cur->add(id, ns);
+	}
+}
+
+#endif //_LAT_H_
@@ -23,7 +23,28 @@
 #include <memory>
 #include <dlfcn.h>
 #include <time.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <sstream>
 #include "ctrl.h"
+#include "replay.h"
+#include "nvml.h"
+#include "sched.h"
+#include "act.h"
+#include "tlog.h"
+#include "shm.h"
+#include "lat.h"
+#include "ctl.h"
+#include "prof.h"
+#include "state.h"
+#include "filt.h"
+#include "budget.h"
+#include "frame.h"
+#include "energy.h"
+#include "attr.h"
 
 namespace {
 	const char*	VERSION = "0.1.0";
@@ -32,16 +53,41 @@ namespace {
 	namespace opt {
 		unsigned int	max_fan_speed = 80, // 80% fan speed
 				max_gpu_temp = 80, // 80 C temperature
-				gpu_id = 0,
 				sleep_interval_ms = 250,
+				min_interval_ms = 50,
+				max_interval_ms = 2000,
 				min_limit_pct = 0,
-				max_mw_limit = 0;
-		bool		do_not_limit = false,
+				max_mw_limit = 0,
+				node_budget_w = 0,
+				frame_target_us = 16667,
+				top_procs = 0,
+				min_write_ms = 500;
+		std::vector<unsigned int>	gpu_ids = { 0 };
+		std::vector<std::string>	filters;
+		std::vector<ctrl::constraint>	constraints;
+		bool		all_gpus = false,
+				do_not_limit = false,
 				verbose = false,
 				log_csv = false,
 				report_max = false,
-				print_current = false;
-		std::string	fan_ctrl = "gpu_temp";
+				print_current = false,
+				fixed_interval = false,
+				shm = false,
+				pid_gains_set = false,
+				fan_ctrl_set = false,
+				daemon = false;
+		double		pid_gains[3] = { 10.0, 0.5, 0.0 };
+		std::string	fan_ctrl = "gpu_temp",
+				actuator = "power",
+				nvml_lib,
+				replay_file,
+				log_bin,
+				log_to_csv,
+				sock_path = ctl::SOCK_PATH,
+				ctl_cmd,
+				profiles,
+				state_file,
+				frame_src;
 	}
 
 	void print_help(const char *prog, const char *version) {
@@ -49,22 +95,101 @@ namespace {
 				"Controls the power limit of a given Nvidia GPU based on max fan speed\n\n"
 				"-f, --max-fan f     Specifies the target max fan speed, default is " << opt::max_fan_speed << "%\n"
 				"-t, --max-temp t    Specifies the target max gpu temperature, default is " << opt::max_gpu_temp << "C\n"
-				"    --gpu-id i      Specifies a specific gpu id to control, default is " << opt::gpu_id << "\n"
+				"    --gpu-id i      Specifies a specific gpu id to control, default is " << opt::gpu_ids[0] << ".\n"
+				"                    Multiple ids can be specified as a comma separated list (i.e. 0,2,5)\n"
+				"    --all-gpus      Controls all the Nvidia GPUs found on this system, each one with its\n"
+				"                    own fan control algorithm instance\n"
 				"    --do-not-limit  Don't limit power - useful to print stats for testing\n"
 				"    --fan-ctrl f    Set the fan control algorithm to 'f'. Valid values are currently:\n"
 				"                    'simple'   - Reactive based on current fan speed\n"
 				"                    'wavg'     - Weights averages and smooths transitions\n"
 				"                    'gpu_temp' - Reactive based on GPU temperature alone\n"
+				"                    'pid'      - PID controller on GPU temperature and fan speed, with\n"
+				"                                 gains auto-tuned the first time the target is reached\n"
+				"                    'mpc'      - Learns how temperature and fan speed respond to power and sets\n"
+				"                                 the highest limit predicted to stay under target 10s ahead\n"
+				"                    'ppw'      - Searches the power limit giving the most SM clock per watt\n"
+				"                                 (perf per watt), within the fan speed and temperature targets\n"
+				"                    'multi'    - Sets the highest limit satisfying all of max fan speed,\n"
+				"                                 max temperature and '--constraint', each one with its own\n"
+				"                                 PI controller (using the '--pid-gains')\n"
+				"                    'frame'    - Sets the lowest limit keeping the p99 frame time read from\n"
+				"                                 '--frame-src' under '--frame-target', within max fan speed\n"
+				"                                 and max temperature\n"
+				"                    'joint'    - Drives the fans too: runs them up to max fan speed before\n"
+				"                                 lowering the limit under max temperature, and slows them\n"
+				"                                 down once the limit is back at max (the firmware fan\n"
+				"                                 curve is restored on exit)\n"
 				"                    Default is '" << opt::fan_ctrl << "'\n"
+				"    --constraint c  Adds constraint 'c' to the 'multi' fan control (selected by default\n"
+				"                    when given), one of 'fan<=%', 'temp<=C', 'mem_temp<=C' and 'power<=W'\n"
+				"                    (i.e. 'mem_temp<=95'); can be repeated\n"
+				"    --frame-src p   Reads frame times (ms) for the 'frame' fan control (selected by default\n"
+				"                    when given) from FIFO 'p', created if missing, or from Unix socket\n"
+				"                    'unix:p'; one per line, or CSV with a 'frametime' column (i.e. MangoHud)\n"
+				"    --frame-target t Sets the p99 frame time target (ms) of 'frame', default is " << opt::frame_target_us/1000.0 << "ms\n"
+				"    --filter s      Filters the samples the fan control algorithm sees, 's' is\n"
+				"                    'signal=filter[,filter...]' with signal 'fan', 'temp' or 'pwr'\n"
+				"                    and filter one of 'ewma:tau_ms', 'median:n', 'rate:max_per_s' and\n"
+				"                    'kalman:q:r', applied in order (i.e. 'temp=median:5,ewma:2000');\n"
+				"                    can be repeated for different signals\n"
+				"    --pid-gains g   Sets the 'pid' gains as 'kp,ki,kd' (W/C, W/(C*s), W*s/C) skipping\n"
+				"                    auto-tuning (i.e. the ones printed after auto-tuning)\n"
 				"-w, --max-mwatt     Specifies a maximum power limit (in mW) without dynamically adjust it\n"
 				"    --report-max    On exit prints how many seconds the fan speed has been\n"
-				"                    above max speed\n"
+				"                    above max speed, power limit writes, energy drawn and saved,\n"
+				"                    time per power limit band and the latencies of NVML calls and\n"
+				"                    loop iterations (also printed on SIGUSR1)\n"
+				"    --top-procs n   Splits the energy drawn across the processes running on each GPU,\n"
+				"                    by their SM and memory utilization, every second on its own\n"
+				"                    thread and prints the top 'n' on exit (also on SIGUSR1)\n"
+				"    --node-budget w Splits a total power budget of 'w' W across all the controlled GPUs,\n"
+				"                    every second, giving more to the ones busy and cool and less to\n"
+				"                    the ones idle or hot; each GPU still keeps its own targets\n"
 				"-m, --min-limit     Sets minimum percentage limit as a low threshold of how much the\n"
 				"                    power can be decreased (i.e. 90 would imply power to never go\n"
 				"                    lower than 90% of current max power limit - default 0)\n" 
+				"    --min-write-ms i Power limits are written at most once every 'i' ms (the latest\n"
+				"                    target is written as soon as allowed), default is " << opt::min_write_ms << "ms\n"
+				"    --actuator a    Sets how the power target is enforced: 'power' writes the power limit,\n"
+				"                    'clocks' locks the max graphics clock to the supported one expected\n"
+				"                    to draw it (faster to react), default is '" << opt::actuator << "'\n"
+				"    --interval-ms i Sets the nominal sampling interval to 'i' ms, default is " << opt::sleep_interval_ms << "ms.\n"
+				"                    Sampling is faster (down to --min-interval-ms, default " << opt::min_interval_ms << "ms) when\n"
+				"                    fan speed or temperature are close to target or changing quickly, and\n"
+				"                    slower (up to --max-interval-ms, default " << opt::max_interval_ms << "ms) when the GPU is idle\n"
+				"    --fixed-interval Always samples every --interval-ms\n"
 				"-l, --log-csv       Prints CSV log-like information to std out\n"
-				"    --verbose       Prints additional log every iteration (4 times a second)\n"
+				"    --log-bin file  Writes the same information in a compact binary format to 'file'\n"
+				"                    (about 10 times smaller than CSV), can be used with '--log-csv'\n"
+				"    --log-to-csv file Doesn't control any GPU, instead converts the binary log 'file'\n"
+				"                    to CSV on std out, as if recorded with '--log-csv'\n"
+				"    --verbose       Prints additional log every iteration\n"
+				"    --shm           Publishes the latest sample, power limit and action of each GPU\n"
+				"                    in shared memory '" << shm::SEG_NAME << "', for other tools to read without\n"
+				"                    calling NVML (i.e. 'nv-pwr-stat', built with 'make stat')\n"
 				"-c, --current       Prints current power, limit and GPU temperature on std::err\n"
+				"    --replay file   Doesn't control any GPU, instead replays the CSV file produced by\n"
+				"                    '--log-csv' through the fan control algorithm as fast as possible,\n"
+				"                    printing the power limit decisions on std::out and a summary on\n"
+				"                    std::err. Recorded samples don't react to the replayed decisions\n"
+				"    --daemon        Runs as a service: accepts commands on a control socket to change\n"
+				"                    targets, fan control algorithm and min limit, pause/resume limiting\n"
+				"                    and query the state, all without restarting\n"
+				"    --socket s      Uses 's' as control socket, default is '" << opt::sock_path << "'\n"
+				"    --ctl c         Doesn't control any GPU, instead sends command 'c' to the running\n"
+				"                    '--daemon' and prints the reply. Valid commands are:\n"
+				"                    'status', 'pause', 'resume', 'set max-fan f', 'set max-temp t',\n"
+				"                    'set min-limit m' and 'set fan-ctrl f'\n"
+				"    --profiles file Switches settings while given processes run on a GPU, 'file' has\n"
+				"                    one line per process name (as in /proc/<pid>/comm) followed by\n"
+				"                    any of 'max-fan=f', 'max-temp=t', 'min-limit=m' and 'fan-ctrl=f',\n"
+				"                    earlier lines taking priority (i.e. 'blender max-temp=70 fan-ctrl=ppw')\n"
+				"    --state file    Saves on exit the power limit each GPU settled at and what the fan\n"
+				"                    control algorithm learnt, per profile and ambient temperature,\n"
+				"                    and starts from those the next time (i.e. /var/lib/nv-pwr-ctrl.state)\n"
+				"    --nvml-lib l    Loads NVML from shared library 'l' instead of the system one\n"
+				"                    (i.e. the simulator built with 'make sim')\n"
 				"    --help          Prints this help and exit\n\n"
 				"Run with root/admin privileges to be able to change the power limits\n\n"
 		<< std::flush;
@@ -76,6 +201,7 @@ namespace {
 			{"max-fan",	required_argument, 0,	'f'},
 			{"max-temp",	required_argument, 0,	't'},
 			{"gpu-id",	required_argument, 0,	0},
+			{"all-gpus",	no_argument,       0,	0},
 			{"do-not-limit",no_argument,       0,	0},
 			{"fan-ctrl",	required_argument, 0,	0},
 			{"report-max",  no_argument,       0,	0},
@@ -85,6 +211,29 @@ namespace {
 			{"verbose",	no_argument,       0,	0},
 			{"help",	no_argument,	   0,	0},
 			{"current",	no_argument,	   0,	0},
+			{"nvml-lib",	required_argument, 0,	0},
+			{"replay",	required_argument, 0,	0},
+			{"interval-ms",	required_argument, 0,	0},
+			{"min-interval-ms",	required_argument, 0,	0},
+			{"max-interval-ms",	required_argument, 0,	0},
+			{"fixed-interval",	no_argument,       0,	0},
+			{"min-write-ms",	required_argument, 0,	0},
+			{"pid-gains",	required_argument, 0,	0},
+			{"log-bin",	required_argument, 0,	0},
+			{"log-to-csv",	required_argument, 0,	0},
+			{"shm",		no_argument,       0,	0},
+			{"daemon",	no_argument,       0,	0},
+			{"socket",	required_argument, 0,	0},
+			{"ctl",		required_argument, 0,	0},
+			{"profiles",	required_argument, 0,	0},
+			{"state",	required_argument, 0,	0},
+			{"filter",	required_argument, 0,	0},
+			{"constraint",	required_argument, 0,	0},
+			{"node-budget",	required_argument, 0,	0},
+			{"actuator",	required_argument, 0,	0},
+			{"frame-src",	required_argument, 0,	0},
+			{"frame-target",	required_argument, 0,	0},
+			{"top-procs",	required_argument, 0,	0},
 			{0, 0, 0, 0}
 		};
 
@@ -104,17 +253,95 @@ namespace {
 					print_help(prog, version);
 					std::exit(0);
 				} else if (!std::strcmp("gpu-id", long_options[option_index].name)) {
-					const int	g_id = std::atoi(optarg);
-					if(g_id >= 0)
-						opt::gpu_id = g_id;
+					opt::gpu_ids.clear();
+					const char	*p = optarg;
+					while(p && *p) {
+						const int	g_id = std::atoi(p);
+						if(g_id >= 0 && std::find(opt::gpu_ids.begin(), opt::gpu_ids.end(), g_id) == opt::gpu_ids.end())
+							opt::gpu_ids.push_back(g_id);
+						if((p = std::strchr(p, ',')))
+							++p;
+					}
+					if(opt::gpu_ids.empty())
+						throw std::runtime_error((std::string("Invalid gpu id list: ") + optarg).c_str());
+				} else if (!std::strcmp("all-gpus", long_options[option_index].name)) {
+					opt::all_gpus = true;
 				} else if (!std::strcmp("verbose", long_options[option_index].name)) {
 					opt::verbose = true;
 				} else if (!std::strcmp("do-not-limit", long_options[option_index].name)) {
 					opt::do_not_limit = true;
 				} else if (!std::strcmp("fan-ctrl", long_options[option_index].name)) {
 					opt::fan_ctrl = optarg;
+					opt::fan_ctrl_set = true;
 				} else if (!std::strcmp("report-max", long_options[option_index].name)) {
 					opt::report_max = true;
+				} else if (!std::strcmp("nvml-lib", long_options[option_index].name)) {
+					opt::nvml_lib = optarg;
+				} else if (!std::strcmp("replay", long_options[option_index].name)) {
+					opt::replay_file = optarg;
+				} else if (!std::strcmp("shm", long_options[option_index].name)) {
+					opt::shm = true;
+				} else if (!std::strcmp("daemon", long_options[option_index].name)) {
+					opt::daemon = true;
+				} else if (!std::strcmp("socket", long_options[option_index].name)) {
+					opt::sock_path = optarg;
+				} else if (!std::strcmp("ctl", long_options[option_index].name)) {
+					opt::ctl_cmd = optarg;
+				} else if (!std::strcmp("profiles", long_options[option_index].name)) {
+					opt::profiles = optarg;
+				} else if (!std::strcmp("state", long_options[option_index].name)) {
+					opt::state_file = optarg;
+				} else if (!std::strcmp("filter", long_options[option_index].name)) {
+					opt::filters.push_back(optarg);
+				} else if (!std::strcmp("constraint", long_options[option_index].name)) {
+					opt::constraints.push_back(ctrl::parse_constraint(optarg));
+				} else if (!std::strcmp("node-budget", long_options[option_index].name)) {
+					const int	b_w = std::atoi(optarg);
+					if(b_w <= 0)
+						throw std::runtime_error((std::string("Invalid node budget: ") + optarg).c_str());
+					opt::node_budget_w = b_w;
+				} else if (!std::strcmp("actuator", long_options[option_index].name)) {
+					if(std::strcmp("power", optarg) && std::strcmp("clocks", optarg))
+						throw std::runtime_error((std::string("Invalid actuator: ") + optarg).c_str());
+					opt::actuator = optarg;
+				} else if (!std::strcmp("frame-src", long_options[option_index].name)) {
+					opt::frame_src = optarg;
+				} else if (!std::strcmp("top-procs", long_options[option_index].name)) {
+					const int	n = std::atoi(optarg);
+					if(n <= 0)
+						throw std::runtime_error((std::string("Invalid number of top processes: ") + optarg).c_str());
+					opt::top_procs = n;
+				} else if (!std::strcmp("frame-target", long_options[option_index].name)) {
+					const double	t_ms = std::atof(optarg);
+					if(t_ms < 1.0 || t_ms > 1000.0)
+						throw std::runtime_error((std::string("Invalid frame time target: ") + optarg).c_str());
+					opt::frame_target_us = static_cast<unsigned int>(t_ms*1000.0 + 0.5);
+				} else if (!std::strcmp("log-bin", long_options[option_index].name)) {
+					opt::log_bin = optarg;
+				} else if (!std::strcmp("log-to-csv", long_options[option_index].name)) {
+					opt::log_to_csv = optarg;
+				} else if (!std::strcmp("interval-ms", long_options[option_index].name)) {
+					const int	i_ms = std::atoi(optarg);
+					if(i_ms >= 10 && i_ms <= 60000)
+						opt::sleep_interval_ms = i_ms;
+				} else if (!std::strcmp("min-interval-ms", long_options[option_index].name)) {
+					const int	i_ms = std::atoi(optarg);
+					if(i_ms >= 10 && i_ms <= 60000)
+						opt::min_interval_ms = i_ms;
+				} else if (!std::strcmp("max-interval-ms", long_options[option_index].name)) {
+					const int	i_ms = std::atoi(optarg);
+					if(i_ms >= 10 && i_ms <= 60000)
+						opt::max_interval_ms = i_ms;
+				} else if (!std::strcmp("fixed-interval", long_options[option_index].name)) {
+					opt::fixed_interval = true;
+				} else if (!std::strcmp("pid-gains", long_options[option_index].name)) {
+					if(3 != std::sscanf(optarg, "%lf,%lf,%lf", &opt::pid_gains[0], &opt::pid_gains[1], &opt::pid_gains[2]))
+						throw std::runtime_error((std::string("Invalid pid gains: ") + optarg).c_str());
+					opt::pid_gains_set = true;
+				} else if (!std::strcmp("min-write-ms", long_options[option_index].name)) {
+					const int	w_ms = std::atoi(optarg);
+					if(w_ms >= 0 && w_ms <= 60000)
+						opt::min_write_ms = w_ms;
 				} else {
 					throw std::runtime_error((std::string("Unknown option: ") + long_options[option_index].name).c_str());
 				}
@@ -161,266 +388,820 @@ namespace {
 				throw std::runtime_error((std::string("Invalid option '") + (char)c + "'").c_str());
 			}
 		}
+		if(!opt::constraints.empty() && !opt::fan_ctrl_set)
+			opt::fan_ctrl = "multi";
+		if(!opt::frame_src.empty() && !opt::fan_ctrl_set)
+			opt::fan_ctrl = "frame";
+		// adaptive intervals have to include the nominal one
+		if(opt::min_interval_ms > opt::sleep_interval_ms)
+			opt::min_interval_ms = opt::sleep_interval_ms;
+		if(opt::max_interval_ms < opt::sleep_interval_ms)
+			opt::max_interval_ms = opt::sleep_interval_ms;
 		return optind;
 	}
 
-	bool	run = true;
-	void	(*prev_sigint_handler)(int) = 0;
+	std::atomic<bool>	run(true);
+	void			(*prev_stop_handler)(int) = 0;
+	// bumped on SIGUSR1, each device thread then
+	// prints its latency histograms
+	std::atomic<unsigned int>	dump_latency(0);
 
-	void sigint_handler(int signal) {
+	void sigusr1_handler(int signal) {
+		++dump_latency;
+	}
+
+	// SIGINT and SIGTERM
+	void stop_handler(int signal) {
 		run = false;
+		sched::request_stop();
 		// reset to previous handler
-		if(prev_sigint_handler)
-			std::signal(SIGINT, prev_sigint_handler);
+		if(prev_stop_handler)
+			std::signal(signal, prev_stop_handler);
+	}
+
+	// settings which can be changed through the
+	// control socket while running; device loops
+	// check the version every iteration and only
+	// lock when it changed
+	struct settings {
+		unsigned int	max_fan_speed,
+				max_gpu_temp,
+				min_limit_pct;
+		std::string	fan_ctrl;
+		bool		paused;
+		// active profile, empty when none
+		std::string	profile;
+	};
+
+	std::mutex			settings_mtx;
+	settings			live;
+	std::atomic<unsigned int>	live_ver(0);
+	// null without '--state'
+	state::store			*saved = 0;
+
+	ctrl::params get_params(const settings& s) {
+		return { s.max_fan_speed, s.max_gpu_temp, std::max(1U, 1000/opt::sleep_interval_ms), opt::verbose,
+			 !opt::pid_gains_set, opt::pid_gains[0], opt::pid_gains[1], opt::pid_gains[2], opt::constraints, opt::frame_target_us };
 	}
 
 }
 
-namespace nvml {
-	const char	SO_NAME[] = "libnvidia-ml.so";
-	
-	// types definitions (compatible)
-	typedef void*	nvmlDevice_t;
-
-	// function pointers definitions
-	typedef int (*fp_nvmlInit_v2)(void);
-	typedef int (*fp_nvmlShutdown)(void);
-	typedef int (*fp_nvmlDeviceGetCount_v2)(unsigned int*);
-	typedef int (*fp_nvmlDeviceGetHandleByIndex_v2)(unsigned int, nvmlDevice_t*);
-	typedef int (*fp_nvmlDeviceGetName)(nvmlDevice_t, char*, unsigned int);
-	typedef int (*fp_nvmlDeviceGetPowerManagementDefaultLimit)(nvmlDevice_t, unsigned int*);
-	typedef int (*fp_nvmlDeviceGetPowerManagementLimit)(nvmlDevice_t, unsigned int*);
-	typedef int (*fp_nvmlDeviceGetFanSpeed)(nvmlDevice_t, unsigned int*);
-	typedef int (*fp_nvmlDeviceGetTemperature)(nvmlDevice_t, const int, unsigned int*);
-	typedef int (*fp_nvmlDeviceGetPowerUsage)(nvmlDevice_t, unsigned int*);
-	typedef int (*fp_nvmlDeviceSetPowerManagementLimit)(nvmlDevice_t, unsigned int);
-	typedef const char* (*fp_nvmlErrorString)(int);
-
-	// functions themselves
-	fp_nvmlInit_v2					nvmlInit_v2 = 0;
-	fp_nvmlShutdown					nvmlShutdown = 0;
-	fp_nvmlDeviceGetCount_v2			nvmlDeviceGetCount_v2 = 0;
-	fp_nvmlDeviceGetHandleByIndex_v2		nvmlDeviceGetHandleByIndex_v2 = 0;
-	fp_nvmlDeviceGetName				nvmlDeviceGetName = 0;
-	fp_nvmlDeviceGetPowerManagementDefaultLimit	nvmlDeviceGetPowerManagementDefaultLimit = 0;
-	fp_nvmlDeviceGetPowerManagementLimit		nvmlDeviceGetPowerManagementLimit = 0;
-	fp_nvmlDeviceGetFanSpeed			nvmlDeviceGetFanSpeed = 0;
-	fp_nvmlDeviceGetTemperature			nvmlDeviceGetTemperature = 0;
-	fp_nvmlDeviceGetPowerUsage			nvmlDeviceGetPowerUsage = 0;
-	fp_nvmlDeviceSetPowerManagementLimit		nvmlDeviceSetPowerManagementLimit = 0;
-	fp_nvmlErrorString				nvmlErrorString = 0;
-
-	void load_functions(void* nvml_so) {
-#define	LOAD_SYMBOL(x) \
-	do { \
-		x = (fp_##x)dlsym(nvml_so, #x); \
-		if(!x) \
-			throw std::runtime_error("Can't load function ##x"); \
-	} while(0);
-
-		LOAD_SYMBOL(nvmlInit_v2);
-		LOAD_SYMBOL(nvmlShutdown);
-		LOAD_SYMBOL(nvmlDeviceGetCount_v2);
-		LOAD_SYMBOL(nvmlDeviceGetHandleByIndex_v2);
-		LOAD_SYMBOL(nvmlDeviceGetName);
-		LOAD_SYMBOL(nvmlDeviceGetPowerManagementDefaultLimit);
-		LOAD_SYMBOL(nvmlDeviceGetPowerManagementLimit);
-		LOAD_SYMBOL(nvmlDeviceGetFanSpeed);
-		LOAD_SYMBOL(nvmlDeviceGetTemperature);
-		LOAD_SYMBOL(nvmlDeviceGetPowerUsage);
-		LOAD_SYMBOL(nvmlDeviceSetPowerManagementLimit);
-		LOAD_SYMBOL(nvmlErrorString);
-
-#undef	LOAD_SYMBOL
+namespace {
+	// serializes writes on std::cout/std::cerr
+	// coming from different device threads
+	std::mutex	out_mtx;
+
+	// each controlled GPU has its own state and
+	// fan control algorithm instance and runs its
+	// own loop on a dedicated thread, so that
+	// a slow NVML call on one device won't delay
+	// sampling on the others
+	struct device {
+		unsigned int			id;
+		size_t				idx;
+		nvml::nvmlDevice_t		dev;
+		std::string			name;
+		unsigned int			gpu_pwr_limit,
+						max_mw_limit,
+						min_tgt_gpu_pwr_limit;
+		std::unique_ptr<ctrl::throttle>	thr;
+		std::unique_ptr<act::actuator>	pwr;
+		// null when the device can't set fan
+		// speeds, no_fan tells why
+		std::unique_ptr<act::fan_duty>	fan;
+		std::string			no_fan;
+		// null without '--filter'
+		std::unique_ptr<filt::pipeline>	filt;
+		std::unique_ptr<energy::meter>	energy;
+		lat::table			lat;
+		size_t				iter,
+						fan_over_max_ms,
+						temp_over_max_ms;
+		std::string			error;
+		// latest sample, for 'status' on
+		// the control socket
+		std::mutex			st_mtx;
+		shm::sample			st;
+		std::string			binding;
+		// profile matching the processes running
+		// on this GPU, under settings_mtx
+		const prof::profile		*prof;
+		// for the saved state: average limit and
+		// lowest temperature since the current
+		// profile and fan control got applied
+		std::string			uuid;
+		double				avg_limit;
+		unsigned int			avg_ms,
+						min_temp,
+		// after a warm start the limit isn't raised above
+		// the saved one until the GPU warmed up
+						warm_cap,
+						warm_ms;
+	};
+
+	// settings_mtx has to be held
+	settings get_settings(const device& d) {
+		settings	s = live;
+		if(!d.prof)
+			return s;
+		const auto&	p = *d.prof;
+		if(p.max_fan_speed >= 0)
+			s.max_fan_speed = p.max_fan_speed;
+		if(p.max_gpu_temp >= 0)
+			s.max_gpu_temp = p.max_gpu_temp;
+		if(p.min_limit_pct >= 0)
+			s.min_limit_pct = p.min_limit_pct;
+		if(!p.fan_ctrl.empty())
+			s.fan_ctrl = p.fan_ctrl;
+		s.profile = p.comm;
+		return s;
 	}
 
-	int pvt_nvmlDeviceGetFanSpeed(nvmlDevice_t dev, unsigned int* v) {
-		const auto	rv = nvmlDeviceGetFanSpeed(dev, v);
-		if(rv == 999) {
-			// this is NVML_ERROR_UNKNOWN
-			// and is when nvidia-settings instead
-			// is able to report 125% fan speed
-			// then modify the value and return
-			*v = 125;
-			return 0;
+	// a minute of limiting is needed for the
+	// average limit to be meaningful
+	const unsigned int	MIN_STATE_MS = 60*1000,
+				MAX_WARM_MS = 3*60*1000;
+
+	void save_state(device& d, const settings& cur) {
+		if(!saved || d.avg_ms < MIN_STATE_MS)
+			return;
+		saved->put({ d.uuid, cur.profile, cur.fan_ctrl, state::ambient_bucket(d.min_temp), static_cast<unsigned int>(d.avg_limit), d.thr->save() });
+	}
+
+	// starts from the saved limit and throttle state
+	// for the current profile and fan control, if any
+	void warm_start(device& d, const settings& cur, const unsigned int gpu_temp) {
+		d.avg_ms = d.warm_cap = d.warm_ms = 0;
+		d.min_temp = gpu_temp;
+		state::entry	e;
+		if(!saved || opt::do_not_limit || d.max_mw_limit || cur.paused || !saved->find(d.uuid, cur.profile, cur.fan_ctrl, gpu_temp, e))
+			return;
+		unsigned int	limit = e.limit_mw;
+		if(limit > d.pwr->max_limit())
+			limit = d.pwr->max_limit();
+		if(limit < d.pwr->min_limit())
+			limit = d.pwr->min_limit();
+		d.pwr->set(limit);
+		d.warm_cap = limit;
+		const bool	thr_loaded = !e.thr.empty() && d.thr->load(e.thr);
+		std::lock_guard<std::mutex>	l(out_mtx);
+		std::cerr << "GPU[" << d.id << "] warm start" << (cur.profile.empty() ? "" : " for profile '" + cur.profile + "'") << " (ambient ~" << e.ambient_c
+			  << "C): power limit " << limit << "mW" << (thr_loaded ? ", '" + cur.fan_ctrl + "' state restored" : std::string()) << std::endl;
+	}
+
+	void restore_limit(device& d) {
+		// the fans go back to the firmware curve
+		// whatever happens to the limit
+		bool		fan_restored = false;
+		std::string	fan_error;
+		if(d.fan) {
+			try {
+				fan_restored = d.fan->restore();
+			} catch(const std::exception& e) {
+				fan_error = e.what();
+			}
+		}
+		// before quitting, restore original power limits
+		// only if those got changed
+		const bool	restored = d.pwr->restore();
+		if(opt::verbose) {
+			std::lock_guard<std::mutex>	l(out_mtx);
+			std::cerr << "GPU[" << d.id << "] " << (restored ? "restored original" : "unchanged") << " " << (std::strcmp("clocks", d.pwr->name()) ? "max power limit: " + std::to_string(d.gpu_pwr_limit) + "mW" : std::string("graphics clocks")) << std::endl;
+			if(fan_restored)
+				std::cerr << "GPU[" << d.id << "] restored firmware fan control" << std::endl;
+		}
+		if(!fan_error.empty())
+			throw std::runtime_error(fan_error.c_str());
+	}
+
+	void print_energy(const device& d, const bool multi_gpu) {
+		const auto&	e = *d.energy;
+		const double	s = e.ms()/1000.0,
+		      		j = e.energy_mj()/1000.0,
+		      		saved_j = e.saved_mj()/1000.0;
+		if(!e.ms())
+			return;
+		const std::string	pfx = multi_gpu ? "GPU[" + std::to_string(d.id) + "] \"" + d.name + "\": " : "";
+		char			buf[256];
+		std::snprintf(buf, sizeof(buf), "Energy: %.1fJ over %.1fs (avg %.1fW, %s), estimated saved vs default limit ~%.1fJ (%.1f%%)", j, s, j/s,
+			      (e.counter_ms() >= e.ms()/2) ? "board counter" : "integrated power", saved_j, (j + saved_j > 0.0) ? 100.0*saved_j/(j + saved_j) : 0.0);
+		std::cerr << pfx << buf << std::endl;
+		std::cerr << pfx << "Time per power limit band (% of default limit):";
+		for(unsigned int i = 0; i < energy::N_BANDS; ++i) {
+			if(!e.band_ms(i))
+				continue;
+			std::snprintf(buf, sizeof(buf), " %u-%u%% %.1fs", i*100/energy::N_BANDS, (i + 1)*100/energy::N_BANDS, e.band_ms(i)/1000.0);
+			std::cerr << buf;
+		}
+		std::cerr << std::endl;
+	}
+
+	void print_latency(const device& d, const bool multi_gpu) {
+		const std::string	prefix = multi_gpu ? "GPU[" + std::to_string(d.id) + "] \"" + d.name + "\": " : "";
+		std::cerr << prefix << "Latencies of NVML calls and control loop iterations:\n";
+		d.lat.print(std::cerr, prefix + "\t");
+		// the writer thread ones once joined
+		if(d.pwr->latency())
+			d.pwr->latency()->print(std::cerr, prefix + "\t(writer) ");
+		// achieved sampling rate
+		const lat::histogram	*h = d.lat.get(lat::site("period"));
+		if(h && h->sum())
+			std::cerr << prefix << "Sampled " << 1000000000.0*h->count()/h->sum() << " times per second (nominal " << 1000.0/opt::sleep_interval_ms << ")\n";
+		std::cerr << std::flush;
+	}
+
+	void print_procs(const device& d, const bool multi_gpu, const attr::collector& attr) {
+		const std::string	prefix = multi_gpu ? "GPU[" + std::to_string(d.id) + "] \"" + d.name + "\": " : "";
+		attr.print(std::cerr, d.idx, opt::top_procs, prefix);
+	}
+
+	// where device loops send their samples to,
+	// besides the fan control algorithm
+	struct outputs {
+		bool		multi_gpu;
+		tlog::writer		*t_log;
+		shm::publisher		*pub;
+		budget::allocator	*budget;
+		frame::source		*frames;
+		attr::collector		*attr;
+	};
+
+	// picks up settings changed through the control socket
+	// or by profiles, keeping the algorithm state when only
+	// targets change. Returns true when the profile or fan
+	// control changed, i.e. a saved state may apply
+	bool apply_settings(device& d, settings& cur, sched::adaptive& adp) {
+		settings	s;
+		{
+			std::lock_guard<std::mutex>	l(settings_mtx);
+			s = get_settings(d);
+		}
+		const bool	new_key = s.profile != cur.profile || s.fan_ctrl != cur.fan_ctrl;
+		if(new_key)
+			save_state(d, cur);
+		if(s.fan_ctrl != cur.fan_ctrl || ((s.max_fan_speed != cur.max_fan_speed || s.max_gpu_temp != cur.max_gpu_temp) && !d.thr->retarget(s.max_fan_speed, s.max_gpu_temp)))
+			d.thr.reset(ctrl::get_fan_ctrl(s.fan_ctrl, get_params(s)));
+		adp.retarget(s.max_fan_speed, s.max_gpu_temp);
+		if(s.min_limit_pct != cur.min_limit_pct && !d.max_mw_limit && !opt::do_not_limit)
+			d.pwr->set_min_limit_pct(s.min_limit_pct);
+		// hand back the default limit while paused
+		if(s.paused && !cur.paused && !d.max_mw_limit) {
+			restore_limit(d);
+			d.pwr->start();
+		}
+		cur = s;
+		return new_key;
+	}
+
+	void device_loop(device& d, const outputs& out) {
+		const auto		dev = d.dev;
+
+		nvml::sampler		smp(dev, opt::verbose);
+		sched::timer		tmr;
+		sched::adaptive		adp(opt::min_interval_ms, opt::sleep_interval_ms, opt::max_interval_ms, opt::max_fan_speed, opt::max_gpu_temp);
+		unsigned int		elapsed_ms = 0,
+					dump_seen = dump_latency,
+					live_seen = 0;
+		// iteration is the time spent working, period
+		// the time between the start of two iterations
+		const size_t		lat_iter = lat::site("iteration"),
+		      			lat_period = lat::site("period");
+		uint64_t		iter_t0 = 0;
+		lat::cur = &d.lat;
+		// limits get written on their own thread
+		// from now on
+		size_t			failed_seen = 0,
+					fan_failed_seen = 0;
+		d.pwr->start();
+		// the throttle has been created with the command
+		// line settings, hence pick up any change (i.e.
+		// a profile matching already) on the first tick
+		settings		cur_st = { opt::max_fan_speed, opt::max_gpu_temp, opt::min_limit_pct, opt::fan_ctrl, false, "" };
+		live_seen = live_ver - 1;
+
+		while(run) {
+			const uint64_t	t0 = lat::now_ns();
+			if(iter_t0)
+				d.lat.add(lat_period, t0 - iter_t0);
+			iter_t0 = t0;
+			if(dump_seen != dump_latency) {
+				dump_seen = dump_latency;
+				std::lock_guard<std::mutex>	l(out_mtx);
+				print_latency(d, out.multi_gpu);
+				if(out.attr)
+					print_procs(d, out.multi_gpu, *out.attr);
+			}
+			bool		warm = !d.iter;
+			if(live_seen != live_ver) {
+				live_seen = live_ver;
+				warm |= apply_settings(d, cur_st, adp);
+			}
+			// 1. get the fan speed, temperature and all the
+			// other sensors
+			nvml::sample	cur = nvml::sample();
+			// the budget is split by utilization too
+			smp.read(cur, d.thr->needs_perf() || out.budget);
+			const unsigned int	cur_fan_speed = cur.fan_speed,
+						cur_gpu_temp = cur.gpu_temp,
+						cur_gpu_pwr = cur.gpu_pwr;
+			if(warm)
+				warm_start(d, cur_st, cur_gpu_temp);
+
+			// formatting and writing happen on the
+			// log writer thread
+			if(out.t_log)
+				out.t_log->push(d.idx, { d.iter, d.id, cur_fan_speed, cur_gpu_temp, cur_gpu_pwr, d.pwr->target(), cur.mem_temp, elapsed_ms, cur.has_mem_temp });
+			// the limit in place since the previous sample
+			d.energy->add(elapsed_ms, cur_gpu_pwr, d.pwr->target(), cur.has_energy, cur.energy_mj);
+			if(out.attr)
+				out.attr->publish(d.idx, static_cast<uint64_t>(d.energy->energy_mj()));
+			if(cur_fan_speed > cur_st.max_fan_speed)
+				d.fan_over_max_ms += elapsed_ms;
+			if(cur_gpu_temp > cur_st.max_gpu_temp)
+				d.temp_over_max_ms += elapsed_ms;
+
+			if(opt::print_current) {
+				std::lock_guard<std::mutex>	l(out_mtx);
+				if(out.multi_gpu)
+					std::fprintf(stderr, "GPU[%d] Current/Target power limit (GPU Temp/Fan Speed): %6d/%6d (%2dC/%2d%%)\n", d.id, cur_gpu_pwr, d.pwr->target(), cur_gpu_temp, cur_fan_speed);
+				else
+					std::fprintf(stderr, "Current/Target power limit (GPU Temp/Fan Speed): %6d/%6d (%2dC/%2d%%) \r", cur_gpu_pwr, d.pwr->target(), cur_gpu_temp, cur_fan_speed);
+			}
+
+			const bool	limiting = !opt::do_not_limit && !d.max_mw_limit && !cur_st.paused;
+			// the share of the node budget becomes
+			// the max limit the throttle can reach
+			if(limiting && out.budget) {
+				const int	headroom = std::min(static_cast<int>(cur_st.max_fan_speed) - static_cast<int>(cur_fan_speed), static_cast<int>(cur_st.max_gpu_temp) - static_cast<int>(cur_gpu_temp));
+				d.pwr->set_max_limit(out.budget->update(d.idx, { cur_gpu_pwr, d.pwr->target(), d.pwr->min_limit(), d.pwr->top_limit(), cur.has_perf ? cur.gpu_util : 100, headroom }));
+			}
+			// filters see every sample, even when
+			// not limiting, to stay current
+			ctrl::throttle::data	thr_d = { cur_fan_speed, cur_gpu_temp, elapsed_ms, cur_gpu_pwr, d.pwr->target(), d.pwr->min_limit(), d.pwr->max_limit(), cur.sm_clock, cur.gpu_util,
+							  cur.has_mem_temp ? cur.mem_temp : 0, out.frames ? out.frames->p99_us(ctrl::FRAME_WINDOW_MS) : 0 };
+			if(d.filt)
+				d.filt->apply(thr_d);
+			float		b_fact = 0.0;
+			ctrl::action	act = ctrl::action::PWR_CNST;
+			if(limiting) {
+				b_fact = 1.0;
+				act = d.thr->check(thr_d, b_fact);
+				// i.e. reactive algorithms would raise the
+				// limit while the GPU is still cold
+				if(d.warm_cap) {
+					d.warm_ms += elapsed_ms;
+					if(d.warm_ms >= MAX_WARM_MS || cur_gpu_temp + 3 >= cur_st.max_gpu_temp || cur_fan_speed + 3 >= cur_st.max_fan_speed)
+						d.warm_cap = 0;
+					else if(act == ctrl::action::PWR_INC && d.pwr->target() >= d.warm_cap)
+						act = ctrl::action::PWR_CNST;
+				}
+				// 2. if the check tells us to decrease then start
+				// reducing the power limit, 3. else increase it
+				d.pwr->apply(act, b_fact, elapsed_ms);
+				// i.e. 'joint' drives the fans too, only
+				// selectable when the device supports it
+				const int	fan_tgt = d.thr->fan_target();
+				if(d.fan && fan_tgt >= 0)
+					d.fan->set(fan_tgt, elapsed_ms);
+				else if(d.fan)
+					d.fan->release(elapsed_ms);
+				if(d.pwr->target() < d.min_tgt_gpu_pwr_limit)
+					d.min_tgt_gpu_pwr_limit = d.pwr->target();
+				// ~1 minute moving average
+				const double	a = (d.avg_ms) ? std::min(1.0, elapsed_ms/60000.0) : 1.0;
+				d.avg_limit += a*(d.pwr->target() - d.avg_limit);
+				d.avg_ms += elapsed_ms;
+				if(cur_gpu_temp < d.min_temp)
+					d.min_temp = cur_gpu_temp;
+			}
+
+			{
+				shm::sample	s;
+				struct timespec	ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				s.iter = d.iter;
+				s.time_ns = ts.tv_sec*1000000000ULL + ts.tv_nsec;
+				s.energy_mj = static_cast<uint64_t>(d.energy->energy_mj());
+				s.saved_mj = static_cast<uint64_t>(d.energy->saved_mj());
+				s.gpu = d.id;
+				s.fan_speed = cur_fan_speed;
+				s.gpu_temp = cur_gpu_temp;
+				s.gpu_pwr = cur_gpu_pwr;
+				s.mem_temp = cur.mem_temp;
+				s.has_mem_temp = cur.has_mem_temp;
+				s.elapsed_ms = elapsed_ms;
+				s.pwr_limit = d.pwr->target();
+				s.min_pwr_limit = d.pwr->min_limit();
+				s.max_pwr_limit = d.pwr->max_limit();
+				s.action = act;
+				s.bump_factor = b_fact;
+				std::strncpy(s.name, d.name.c_str(), sizeof(s.name) - 1);
+				s.name[sizeof(s.name) - 1] = '\0';
+				if(out.pub)
+					out.pub->publish(d.idx, s);
+				if(opt::daemon) {
+					std::lock_guard<std::mutex>	l(d.st_mtx);
+					d.st = s;
+					d.binding = d.thr->binding();
+				}
+			}
+
+			// failed writes are retried by the writer
+			// thread, only tell about them unless it
+			// gave up (i.e. not root)
+			if(d.pwr->gave_up())
+				throw std::runtime_error((d.pwr->last_error() + ", giving up").c_str());
+			const size_t	failed = d.pwr->get_stats().failed;
+			if(failed != failed_seen) {
+				failed_seen = failed;
+				std::lock_guard<std::mutex>	l(out_mtx);
+				std::cerr << "GPU[" << d.id << "] Warning: " << d.pwr->last_error() << ", retrying (" << failed << " failed writes)" << std::endl;
+			}
+			if(d.fan && d.fan->failed() != fan_failed_seen) {
+				fan_failed_seen = d.fan->failed();
+				std::lock_guard<std::mutex>	l(out_mtx);
+				std::cerr << "GPU[" << d.id << "] Warning: " << d.fan->last_error() << ", retrying (" << fan_failed_seen << " failed fan speed writes)" << std::endl;
+			}
+
+			d.lat.add(lat_iter, lat::now_ns() - t0);
+			// wait for the next deadline, sampling faster
+			// when close to the targets and slower when idle
+			const unsigned int	interval_ms = (opt::fixed_interval) ? opt::sleep_interval_ms : adp.next(cur_fan_speed, cur_gpu_temp, elapsed_ms);
+			tmr.wait(interval_ms, elapsed_ms);
+			++d.iter;
+		}
+		save_state(d, cur_st);
+		restore_limit(d);
+	}
+
+	unsigned int get_value(const std::string& what, const std::string& v, const unsigned int min_v, const unsigned int max_v) {
+		char			*end = 0;
+		const long		n = std::strtol(v.c_str(), &end, 10);
+		if(v.empty() || *end || n < min_v || n > max_v)
+			throw std::runtime_error((std::string("Invalid ") + what + " '" + v + "', valid range is " + std::to_string(min_v) + "-" + std::to_string(max_v)).c_str());
+		return n;
+	}
+
+	// throws unless all the devices can set fan speeds
+	void check_fans(const std::vector<device>& devices, const std::string& fan_ctrl) {
+		for(const auto& d : devices) {
+			if(!d.fan)
+				throw std::runtime_error((std::string("GPU[") + std::to_string(d.id) + "] can't use '" + fan_ctrl + "' fan control: " + d.no_fan).c_str());
+		}
+	}
+
+	// runs on the control socket thread
+	std::string handle_cmd(const std::string& line, std::vector<device>& devices) {
+		std::istringstream	is(line);
+		std::string		cmd,
+					what,
+					v;
+		is >> cmd >> what >> v;
+		settings		s;
+		{
+			std::lock_guard<std::mutex>	l(settings_mtx);
+			s = live;
+		}
+		if(cmd == "status") {
+			char	buf[256];
+			std::snprintf(buf, sizeof(buf), "OK fan-ctrl %s, max-fan %u%%, max-temp %uC, min-limit %u%%, %s\n", s.fan_ctrl.c_str(), s.max_fan_speed, s.max_gpu_temp, s.min_limit_pct,
+				      s.paused ? "paused" : (opt::do_not_limit || opt::max_mw_limit) ? "not limiting" : "limiting");
+			std::string	rv(buf);
+			for(auto& d : devices) {
+				shm::sample	st;
+				std::string	p_name,
+						binding;
+				{
+					std::lock_guard<std::mutex>	l(d.st_mtx);
+					st = d.st;
+					binding = d.binding;
+				}
+				{
+					std::lock_guard<std::mutex>	l(settings_mtx);
+					if(d.prof)
+						p_name = d.prof->comm;
+				}
+				std::snprintf(buf, sizeof(buf), "GPU[%u] \"%s\" iter %llu: fan %u%%, temp %uC, power %u/%umW (limits %u-%umW)", d.id, d.name.c_str(),
+					      static_cast<unsigned long long>(st.iter), st.fan_speed, st.gpu_temp, st.gpu_pwr, st.pwr_limit, st.min_pwr_limit, st.max_pwr_limit);
+				rv += buf;
+				std::snprintf(buf, sizeof(buf), ", energy %.1fkJ (saved ~%.1fkJ)", st.energy_mj/1000000.0, st.saved_mj/1000000.0);
+				rv += buf;
+				if(!binding.empty())
+					rv += ", binding '" + binding + "'";
+				rv += p_name.empty() ? "\n" : ", profile '" + p_name + "'\n";
+			}
+			return rv;
+		} else if(cmd == "pause" || cmd == "resume") {
+			s.paused = (cmd == "pause");
+		} else if(cmd == "set" && what == "max-fan") {
+			s.max_fan_speed = get_value(what, v, 1, 100);
+		} else if(cmd == "set" && what == "max-temp") {
+			s.max_gpu_temp = get_value(what, v, 1, 100);
+		} else if(cmd == "set" && what == "min-limit") {
+			s.min_limit_pct = get_value(what, v, 0, 100);
+		} else if(cmd == "set" && what == "fan-ctrl") {
+			// throws when not valid
+			std::unique_ptr<ctrl::throttle>	thr_check(ctrl::get_fan_ctrl(v, get_params(s)));
+			if(thr_check->drives_fans())
+				check_fans(devices, v);
+			s.fan_ctrl = v;
+		} else {
+			return "ERR Unknown command '" + line + "'\n";
+		}
+		{
+			std::lock_guard<std::mutex>	l(settings_mtx);
+			live = s;
+			++live_ver;
+		}
+		if(opt::verbose) {
+			std::lock_guard<std::mutex>	l(out_mtx);
+			std::cerr << "Control socket: '" << line << "'" << std::endl;
 		}
-		return rv;
+		return "OK\n";
 	}
 
-	// all these functions require 'load_functions'
-	// to be called
-	nvmlDevice_t get_device_by_id(const unsigned int id) {
-		unsigned int	max_gpu = 0;
-		if(const int rv = nvmlDeviceGetCount_v2(&max_gpu))
-			throw std::runtime_error((std::string("nvmlDeviceGetCount_v2 failed: ") + std::to_string(rv)).c_str());
-		if(opt::verbose)
-			std::cerr << "Found " << max_gpu << " Nvidia GPUs" << std::endl;
-		if(max_gpu < 1)
-			throw std::runtime_error("Can't find any Nvidia GPU on this system");
-		if(id >= max_gpu)
-			throw std::runtime_error((std::string("Specified gpu id (") + std::to_string(id) + ") outside of max gpu available (" + std::to_string(max_gpu) + ")").c_str());
-		nvmlDevice_t	dev;
-		if(const int rv = nvmlDeviceGetHandleByIndex_v2(id, &dev))
-			throw std::runtime_error((std::string("nvmlDeviceGetHandleByIndex_v2 failed: ") + std::to_string(rv)).c_str());
-		return dev;
+	void device_thread(device& d, const outputs& out) {
+		try {
+			device_loop(d, out);
+		} catch(const std::exception& e) {
+			d.error = e.what();
+		} catch(...) {
+			d.error = "Unknown exception";
+		}
+		if(!d.error.empty()) {
+			// stop all the other devices too
+			run = false;
+			sched::request_stop();
+			// best effort to not leave the GPU
+			// with a low power limit
+			try {
+				restore_limit(d);
+			} catch(...) {
+			}
+		}
 	}
 }
 
 int main(int argc, char *argv[]) {
 	try {
 		// setup sig handler
-		std::signal(SIGINT, sigint_handler);
+		sched::init_stop();
+		std::signal(SIGINT, stop_handler);
+		std::signal(SIGTERM, stop_handler);
+		std::signal(SIGUSR1, sigusr1_handler);
 		// parse args and load nvml
 		const auto				rv = parse_args(argc, argv, argv[0], VERSION);
 		if(rv < 0)
 			return -1;
-		std::unique_ptr<void, void(*)(void*)>	nvml_so(dlopen(nvml::SO_NAME, RTLD_LAZY|RTLD_LOCAL), [](void* p){ if(p) dlclose(p); });
+		live = { opt::max_fan_speed, opt::max_gpu_temp, opt::min_limit_pct, opt::fan_ctrl, false };
+		const ctrl::params			thr_params = get_params(live);
+		if(!opt::ctl_cmd.empty()) {
+			const std::string	reply = ctl::request(opt::sock_path, opt::ctl_cmd);
+			std::cout << reply << std::flush;
+			return reply.compare(0, 2, "OK") ? -1 : 0;
+		}
+		// offline replay and log conversion
+		// don't need NVML
+		if(!opt::replay_file.empty()) {
+			replay::run(opt::replay_file, { opt::fan_ctrl, thr_params, opt::min_limit_pct, opt::sleep_interval_ms, opt::min_write_ms, opt::filters });
+			return 0;
+		}
+		if(!opt::log_to_csv.empty()) {
+			tlog::to_csv(opt::log_to_csv);
+			return 0;
+		}
+		// filters and profiles are checked before
+		// touching any GPU
+		const filt::pipeline			filt_check(opt::filters);
+		const std::vector<prof::profile>	profiles(opt::profiles.empty() ? std::vector<prof::profile>() : prof::load(opt::profiles));
+		for(const auto& p : profiles) {
+			if(!p.fan_ctrl.empty())
+				std::unique_ptr<ctrl::throttle>	p_check(ctrl::get_fan_ctrl(p.fan_ctrl, thr_params));
+		}
+		std::unique_ptr<void, void(*)(void*)>	nvml_so(dlopen(opt::nvml_lib.empty() ? nvml::SO_NAME : opt::nvml_lib.c_str(), RTLD_LAZY|RTLD_LOCAL), [](void* p){ if(p) dlclose(p); });
 		if(!nvml_so)
-			throw std::runtime_error("Can't find/load NVML");
-		std::unique_ptr<ctrl::throttle>		thr(ctrl::get_fan_ctrl(opt::fan_ctrl, { opt::max_fan_speed, opt::max_gpu_temp, 1000/opt::sleep_interval_ms, opt::verbose }));
+			throw std::runtime_error((std::string("Can't find/load NVML: ") + dlerror()).c_str());
+		// ensure the fan control algorithm is valid
+		// before touching any GPU
+		std::unique_ptr<ctrl::throttle>		thr_check(ctrl::get_fan_ctrl(opt::fan_ctrl, thr_params));
 		// load nvml functions/symbols
 		nvml::load_functions(nvml_so.get());
 
-#define SAFE_NVML_CALL(x) \
-	do { \
-		const int rv = (x); \
-		if(rv) \
-			throw std::runtime_error((std::string(#x) + " failed, error (" + std::to_string(rv) + "): " + nvml::nvmlErrorString(rv)).c_str()); \
-	} while(0);
-
 		// init nvml
 		SAFE_NVML_CALL(nvml::nvmlInit_v2());
-		// get device by id
-		const auto	dev = nvml::get_device_by_id(opt::gpu_id);
-		// print out some info
-		char		gpu_name[256];
-		SAFE_NVML_CALL(nvml::nvmlDeviceGetName(dev, gpu_name, 256)); 
-		gpu_name[255] = '\0';
-		// get default power limit
-		unsigned int	gpu_pwr_limit = 0;
-		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementDefaultLimit(dev, &gpu_pwr_limit));
-		// set current min barrier limit
-		const unsigned int	min_pwr_limit = opt::min_limit_pct * gpu_pwr_limit / 100;
-		// print main info
-		std::cerr << "Running on GPU[" << opt::gpu_id << "] \"" << gpu_name << "\"" << std::endl;
-		std::cerr << "Current max power limit: " <<  gpu_pwr_limit << "mW, target max fan speed: " << opt::max_fan_speed
-			  << "%, max GPU temp: " << opt::max_gpu_temp << "C, min power limit: " << min_pwr_limit << "mW" << std::endl;
+		// get devices by id
+		const auto		max_gpu = nvml::get_device_count(opt::verbose);
+		if(opt::all_gpus) {
+			opt::gpu_ids.clear();
+			for(unsigned int i = 0; i < max_gpu; ++i)
+				opt::gpu_ids.push_back(i);
+		}
+		std::vector<device>	devices(opt::gpu_ids.size());
+		for(size_t i = 0; i < devices.size(); ++i) {
+			auto&	d = devices[i];
+			d.id = opt::gpu_ids[i];
+			d.idx = i;
+			d.dev = nvml::get_device_by_id(d.id, max_gpu);
+			// print out some info
+			char		gpu_name[256];
+			SAFE_NVML_CALL(nvml::nvmlDeviceGetName(d.dev, gpu_name, 256)); 
+			gpu_name[255] = '\0';
+			d.name = gpu_name;
+			// get default power limit
+			d.gpu_pwr_limit = 0;
+			SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementDefaultLimit(d.dev, &d.gpu_pwr_limit));
+			d.max_mw_limit = opt::max_mw_limit;
+			d.thr.reset(ctrl::get_fan_ctrl(opt::fan_ctrl, thr_params));
+			if(!opt::filters.empty())
+				d.filt.reset(new filt::pipeline(opt::filters));
+			// set current min barrier limit and get the
+			// limits the board accepts
+			d.energy.reset(new energy::meter(d.gpu_pwr_limit));
+			d.pwr.reset(act::get_actuator(opt::actuator, d.dev, d.gpu_pwr_limit, opt::min_limit_pct, opt::min_write_ms));
+			// only queries the fans, nothing gets
+			// set until the throttle drives them
+			try {
+				d.fan.reset(new act::fan_duty(d.dev, opt::min_write_ms));
+			} catch(const std::exception& e) {
+				d.no_fan = e.what();
+			}
+			d.iter = d.fan_over_max_ms = d.temp_over_max_ms = 0;
+			d.st = shm::sample();
+			d.prof = 0;
+			// saved states are keyed by UUID, which
+			// doesn't change when GPUs get reordered
+			char		gpu_uuid[96];
+			if(nvml::nvmlDeviceGetUUID && !nvml::nvmlDeviceGetUUID(d.dev, gpu_uuid, sizeof(gpu_uuid))) {
+				gpu_uuid[sizeof(gpu_uuid) - 1] = '\0';
+				d.uuid = gpu_uuid;
+			} else {
+				d.uuid = "GPU" + std::to_string(d.id);
+			}
+			d.avg_limit = 0.0;
+			d.avg_ms = d.min_temp = d.warm_cap = d.warm_ms = 0;
+			// print main info
+			std::cerr << "Running on GPU[" << d.id << "] \"" << d.name << "\"" << std::endl;
+			std::cerr << "Current max power limit: " <<  d.gpu_pwr_limit << "mW, target max fan speed: " << opt::max_fan_speed
+				  << "%, max GPU temp: " << opt::max_gpu_temp << "C, min power limit: " << d.pwr->min_limit() << "mW" << std::endl;
+			if(std::strcmp("power", d.pwr->name()))
+				std::cerr << "Actuator: '" << d.pwr->name() << "'" << std::endl;
+			if(opt::verbose)
+				std::cerr << "Power limit constraints: " << d.pwr->hw_min_limit() << "mW - " << d.pwr->hw_max_limit() << "mW" << std::endl;
+			if(d.max_mw_limit) {
+				if(d.max_mw_limit > d.gpu_pwr_limit) {
+					std::cerr << "Warning: max fixed power limit has been set to " << d.max_mw_limit 
+						  << " mW, but greater than current GPUs (" << d.gpu_pwr_limit << " mW), setting to it" << std::endl;
+					d.max_mw_limit = d.gpu_pwr_limit;
+				}
+				if(d.max_mw_limit < d.pwr->hw_min_limit()) {
+					std::cerr << "Warning: max fixed power limit has been set to " << d.max_mw_limit 
+						  << " mW, but lower than GPUs min (" << d.pwr->hw_min_limit() << " mW), setting to it" << std::endl;
+					d.max_mw_limit = d.pwr->hw_min_limit();
+				}
+			}
+			d.min_tgt_gpu_pwr_limit = (d.max_mw_limit) ? d.max_mw_limit : d.pwr->target();
+		}
+		// before touching any limit
+		if(thr_check->drives_fans())
+			check_fans(devices, opt::fan_ctrl);
+		for(const auto& p : profiles) {
+			if(!p.fan_ctrl.empty() && std::unique_ptr<ctrl::throttle>(ctrl::get_fan_ctrl(p.fan_ctrl, thr_params))->drives_fans())
+				check_fans(devices, p.fan_ctrl);
+		}
 		std::cerr << "Fan control selected: '" << opt::fan_ctrl << "'" << std::endl;
 		if(opt::do_not_limit)
 			std::cerr << "Warning: '--do-not-limit' has been set, max power limit won't be modified" << std::endl;
-		if(opt::max_mw_limit) {
-			if(opt::max_mw_limit > gpu_pwr_limit) {
-				std::cerr << "Warning: max fixed power limit has been set to " << opt::max_mw_limit 
-					  << " mW, but greater than current GPUs (" << gpu_pwr_limit << " mW), setting to it" << std::endl;
-				opt::max_mw_limit = gpu_pwr_limit;
-			}
-		}
+		std::unique_ptr<ctl::server>		srv(opt::daemon ? new ctl::server(opt::sock_path, [&devices](const std::string& l){ return handle_cmd(l, devices); }) : 0);
+		if(srv)
+			std::cerr << "Listening for commands on '" << opt::sock_path << "'" << std::endl;
 		// set to constant power limit if so
-		if(opt::max_mw_limit) {
-			SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev, opt::max_mw_limit));
-			std::cerr << "Set max fixed power limit to " << opt::max_mw_limit << " mW" << std::endl;
+		for(auto& d : devices) {
+			if(d.max_mw_limit) {
+				d.pwr->set(d.max_mw_limit);
+				std::cerr << "Set GPU[" << d.id << "] max fixed power limit to " << d.max_mw_limit << " mW" << std::endl;
+			}
 		}
 		std::cerr << "Press Ctrl+C to quit" << std::endl;
-		// main loop
-		const unsigned int	PWR_DELTA = 1000,
-		      			MIN_PWR_LIMIT = 50*1000; // min 50k mW
-		// variable target gpu power limit
-		unsigned int	tgt_gpu_pwr_limit = (opt::max_mw_limit) ? opt::max_mw_limit : gpu_pwr_limit;
-		size_t		iter = 0,
-				fan_over_max = 0;
-		if(opt::log_csv) {
-			// print header
-			std::cout << "Iteration,Fan Speed (%),GPU Temperature (C),Power Usage (mW),Power Limit (mW)" << std::endl;
+		const bool	multi_gpu = devices.size() > 1;
+		std::unique_ptr<FILE, int(*)(FILE*)>	bin_f(opt::log_bin.empty() ? 0 : std::fopen(opt::log_bin.c_str(), "wb"), [](FILE* f){ return f ? std::fclose(f) : 0; });
+		if(!opt::log_bin.empty() && !bin_f)
+			throw std::runtime_error((std::string("Can't open binary log '") + opt::log_bin + "'").c_str());
+		std::unique_ptr<tlog::writer>		t_log((opt::log_csv || bin_f) ? new tlog::writer(opt::log_csv ? stdout : 0, bin_f.get(), multi_gpu, devices.size()) : 0);
+		std::unique_ptr<shm::publisher>		pub(opt::shm ? new shm::publisher(shm::SEG_NAME, devices.size()) : 0);
+		// with --max-mwatt or --do-not-limit there's
+		// nothing to split
+		std::unique_ptr<budget::allocator>	bgt((opt::node_budget_w && !opt::max_mw_limit && !opt::do_not_limit) ? new budget::allocator(opt::node_budget_w*1000, devices.size()) : 0);
+		if(bgt) {
+			unsigned int	sum_min = 0;
+			for(const auto& d : devices)
+				sum_min += d.pwr->min_limit();
+			std::cerr << "Node power budget: " << opt::node_budget_w << "W across " << devices.size() << " GPU(s)" << std::endl;
+			if(sum_min > opt::node_budget_w*1000)
+				std::cerr << "Warning: the min power limits of the GPUs add up to " << sum_min << "mW, above the node budget" << std::endl;
 		}
+		// frame times are the same for all the GPUs
+		std::unique_ptr<frame::source>		frames(opt::frame_src.empty() ? 0 : new frame::source(opt::frame_src));
+		if(frames)
+			std::cerr << "Reading frame times from '" << opt::frame_src << "', p99 target " << opt::frame_target_us/1000.0 << "ms" << std::endl;
+		else if(opt::fan_ctrl == "frame")
+			std::cerr << "Warning: 'frame' fan control without '--frame-src', power limit only bound by fan speed and temperature" << std::endl;
+		// energy per process, polled on its own thread
+		std::unique_ptr<attr::collector>	procs;
+		if(opt::top_procs) {
+			std::vector<nvml::nvmlDevice_t>	devs;
+			for(const auto& d : devices)
+				devs.push_back(d.dev);
+			procs.reset(new attr::collector(devs));
+		}
+		const outputs				out = { multi_gpu, t_log.get(), pub.get(), bgt.get(), frames.get(), procs.get() };
 		if(opt::print_current)
 			std::cerr << std::endl;
-		while(run) {
-			// 1. get the fan speed and temperature
-			unsigned int	cur_fan_speed = 0,
-					cur_gpu_temp = 0,
-					cur_gpu_pwr = 0;
-			SAFE_NVML_CALL(nvml::pvt_nvmlDeviceGetFanSpeed(dev, &cur_fan_speed));
-			SAFE_NVML_CALL(nvml::nvmlDeviceGetTemperature(dev, 0, &cur_gpu_temp));
-			SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerUsage(dev, &cur_gpu_pwr));
-
-			if(opt::log_csv) {
-				std::cout << iter << "," << cur_fan_speed << "," << cur_gpu_temp << "," << cur_gpu_pwr << "," << tgt_gpu_pwr_limit << std::endl;
-			}
-			if(cur_fan_speed > opt::max_fan_speed)
-				++fan_over_max;
-
-			auto fn_do_sleep = [&iter](void) -> void {
-				// sleep for 1/4 of a second
-				struct timespec	ts = { opt::sleep_interval_ms/1000, (opt::sleep_interval_ms%1000)*1000*1000 };
-				nanosleep(&ts, 0);
-				++iter;
-			};
-
-			if(opt::print_current) {
-				std::fprintf(stderr, "Current/Target power limit (GPU Temp/Fan Speed): %6d/%6d (%2dC/%2d%%) \r", cur_gpu_pwr, tgt_gpu_pwr_limit, cur_gpu_temp, cur_fan_speed);
-			}
-
-			if(opt::do_not_limit || opt::max_mw_limit) {
-				fn_do_sleep();
-				continue;
-			}
-
-			float	b_fact = 1.0;
-			switch(thr->check({ cur_fan_speed, cur_gpu_temp }, b_fact)) {
-			// 2. if the check tells us to decrease
-			// then start reducing the power limit
-			case ctrl::action::PWR_DEC: {
-				tgt_gpu_pwr_limit -= b_fact*PWR_DELTA;
-				// if we're lesser than the barrier, reset
-				if(tgt_gpu_pwr_limit < min_pwr_limit) {
-					tgt_gpu_pwr_limit = min_pwr_limit;
-				}
-				// ensure we never go below the hard min pwr limit
-				if(tgt_gpu_pwr_limit < MIN_PWR_LIMIT) {
-					tgt_gpu_pwr_limit = MIN_PWR_LIMIT;
-				}
-				SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev, tgt_gpu_pwr_limit));
-			} break;
-
-			case ctrl::action::PWR_INC: {
-				// 3. increase the power limit
-				if(tgt_gpu_pwr_limit < gpu_pwr_limit) {
-					tgt_gpu_pwr_limit += b_fact*PWR_DELTA;
-					if(tgt_gpu_pwr_limit > gpu_pwr_limit)
-						tgt_gpu_pwr_limit = gpu_pwr_limit;
-					SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev, tgt_gpu_pwr_limit));
+		std::unique_ptr<state::store>		store(opt::state_file.empty() ? 0 : new state::store());
+		if(store) {
+			store->load(opt::state_file);
+			saved = store.get();
+		}
+		// process names are polled on their own
+		// thread, devices pick up the profile
+		// as settings changed on the socket
+		std::unique_ptr<prof::watcher>		watcher;
+		if(!profiles.empty()) {
+			std::vector<nvml::nvmlDevice_t>	devs;
+			for(const auto& d : devices)
+				devs.push_back(d.dev);
+			watcher.reset(new prof::watcher(devs, profiles, [&devices](const size_t idx, const prof::profile* p) {
+				auto&	d = devices[idx];
+				{
+					std::lock_guard<std::mutex>	l(settings_mtx);
+					d.prof = p;
+					++live_ver;
 				}
-			} break;
-
-			case ctrl::action::PWR_CNST:
-			default:
-				break;
+				std::lock_guard<std::mutex>	l(out_mtx);
+				std::cerr << "GPU[" << d.id << "] " << (p ? "profile '" + p->comm + "'" : std::string("default settings")) << " active" << std::endl;
+			}));
+		}
+		// main loop(s), one per device
+		std::vector<std::thread>	threads;
+		for(auto& d : devices)
+			threads.push_back(std::thread(device_thread, std::ref(d), std::cref(out)));
+		for(auto& t : threads)
+			t.join();
+		watcher.reset();
+		srv.reset();
+		if(procs)
+			procs->stop();
+		if(store) {
+			try {
+				store->save(opt::state_file);
+			} catch(const std::exception& e) {
+				std::cerr << "Warning: " << e.what() << std::endl;
 			}
-
-			fn_do_sleep();
 		}
-		std::cerr << "\nExiting" << std::endl;
-		// before quitting, restore original power limits
-		// only if those got changed
-		unsigned int	cur_pwr_limit = 0;
-		SAFE_NVML_CALL(nvml::nvmlDeviceGetPowerManagementLimit(dev, &cur_pwr_limit));
-		if(cur_pwr_limit != gpu_pwr_limit) {
-			SAFE_NVML_CALL(nvml::nvmlDeviceSetPowerManagementLimit(dev, gpu_pwr_limit));
-			if(opt::verbose)
-				std::cerr << "Restored original max power limit: " << gpu_pwr_limit << "mW" << std::endl;
-		} else {
-			if(opt::verbose)
-				std::cerr << "Unchanged max power limit: " << gpu_pwr_limit << "mW" << std::endl;
+		if(t_log) {
+			t_log->stop();
+			if(t_log->dropped())
+				std::cerr << "Warning: " << t_log->dropped() << " log samples have been dropped, output too slow" << std::endl;
 		}
+		std::cerr << "\nExiting" << std::endl;
 		// report how many seconds the fan speed was over max
 		if (opt::report_max) {
-			std::cerr << "Fan speed was above max (" <<opt::max_fan_speed << "%) for " << fan_over_max*opt::sleep_interval_ms/1000 << "s" << std::endl;
+			for(const auto& d : devices) {
+				if(multi_gpu)
+					std::cerr << "GPU[" << d.id << "] \"" << d.name << "\": ";
+				std::cerr << "Fan speed was above max (" << live.max_fan_speed << "%) for " << d.fan_over_max_ms/1000 << "s" << std::endl;
+				if(multi_gpu) {
+					std::cerr << "GPU[" << d.id << "] \"" << d.name << "\": GPU temperature was above max (" << live.max_gpu_temp << "C) for "
+						  << d.temp_over_max_ms/1000 << "s, lowest power limit " << d.min_tgt_gpu_pwr_limit << "mW" << std::endl;
+				}
+				const auto&	st = d.pwr->get_stats();
+				if(multi_gpu)
+					std::cerr << "GPU[" << d.id << "] \"" << d.name << "\": ";
+				std::cerr << "Power limit writes: " << st.issued << " issued, " << st.suppressed << " suppressed (unchanged), "
+					  << st.deferred << " deferred (rate limited), " << st.dropped << " dropped (superseded), " << st.failed << " failed (retried)" << std::endl;
+				if(d.fan && (d.fan->writes() || d.fan->failed())) {
+					if(multi_gpu)
+						std::cerr << "GPU[" << d.id << "] \"" << d.name << "\": ";
+					std::cerr << "Fan speed writes: " << d.fan->writes() << " issued, " << d.fan->failed() << " failed" << std::endl;
+				}
+				print_energy(d, multi_gpu);
+				print_latency(d, multi_gpu);
+			}
+		}
+		if(procs) {
+			for(const auto& d : devices)
+				print_procs(d, multi_gpu, *procs);
 		}
 		// shutdown nvml
 		nvml::nvmlShutdown();
-
-#undef	SAFE_NVML_CALL
-
+		// report any error
+		int	ret = 0;
+		for(const auto& d : devices) {
+			if(d.error.empty())
+				continue;
+			std::cerr << "Exception: GPU[" << d.id << "] " << d.error << std::endl;
+			ret = -1;
+		}
+		return ret;
 	} catch(const std::exception& e) {
 		std::cerr << "Exception: " << e.what() << std::endl;
 		return -1;
@@ -430,4 +1211,3 @@ int main(int argc, char *argv[]) {
 	}
 
 }
-
@@ -0,0 +1,290 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "nvml.h"
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <dlfcn.h>
+
+namespace nvml {
+	const char	SO_NAME[] = "libnvidia-ml.so";
+
+	// functions themselves
+	fp_nvmlInit_v2					nvmlInit_v2 = 0;
+	fp_nvmlShutdown					nvmlShutdown = 0;
+	fp_nvmlDeviceGetCount_v2			nvmlDeviceGetCount_v2 = 0;
+	fp_nvmlDeviceGetHandleByIndex_v2		nvmlDeviceGetHandleByIndex_v2 = 0;
+	fp_nvmlDeviceGetName				nvmlDeviceGetName = 0;
+	fp_nvmlDeviceGetPowerManagementDefaultLimit	nvmlDeviceGetPowerManagementDefaultLimit = 0;
+	fp_nvmlDeviceGetPowerManagementLimit		nvmlDeviceGetPowerManagementLimit = 0;
+	fp_nvmlDeviceGetFanSpeed			nvmlDeviceGetFanSpeed = 0;
+	fp_nvmlDeviceGetTemperature			nvmlDeviceGetTemperature = 0;
+	fp_nvmlDeviceGetPowerUsage			nvmlDeviceGetPowerUsage = 0;
+	fp_nvmlDeviceSetPowerManagementLimit		nvmlDeviceSetPowerManagementLimit = 0;
+	fp_nvmlErrorString				nvmlErrorString = 0;
+	fp_nvmlDeviceGetFieldValues			nvmlDeviceGetFieldValues = 0;
+	fp_nvmlDeviceGetPowerManagementLimitConstraints	nvmlDeviceGetPowerManagementLimitConstraints = 0;
+	fp_nvmlDeviceGetClockInfo			nvmlDeviceGetClockInfo = 0;
+	fp_nvmlDeviceGetUtilizationRates		nvmlDeviceGetUtilizationRates = 0;
+	fp_nvmlDeviceGetRunningProcesses		nvmlDeviceGetComputeRunningProcesses = 0;
+	fp_nvmlDeviceGetRunningProcesses		nvmlDeviceGetGraphicsRunningProcesses = 0;
+	fp_nvmlDeviceGetUUID				nvmlDeviceGetUUID = 0;
+	fp_nvmlDeviceGetSupportedMemoryClocks		nvmlDeviceGetSupportedMemoryClocks = 0;
+	fp_nvmlDeviceGetSupportedGraphicsClocks		nvmlDeviceGetSupportedGraphicsClocks = 0;
+	fp_nvmlDeviceSetGpuLockedClocks			nvmlDeviceSetGpuLockedClocks = 0;
+	fp_nvmlDeviceResetGpuLockedClocks		nvmlDeviceResetGpuLockedClocks = 0;
+	fp_nvmlDeviceGetTotalEnergyConsumption		nvmlDeviceGetTotalEnergyConsumption = 0;
+	fp_nvmlDeviceGetProcessUtilization		nvmlDeviceGetProcessUtilization = 0;
+	fp_nvmlDeviceGetNumFans				nvmlDeviceGetNumFans = 0;
+	fp_nvmlDeviceGetMinMaxFanSpeed			nvmlDeviceGetMinMaxFanSpeed = 0;
+	fp_nvmlDeviceSetFanSpeed_v2			nvmlDeviceSetFanSpeed_v2 = 0;
+	fp_nvmlDeviceSetDefaultFanSpeed_v2		nvmlDeviceSetDefaultFanSpeed_v2 = 0;
+
+	void load_functions(void* nvml_so) {
+#define	LOAD_SYMBOL(x) \
+	do { \
+		x = (fp_##x)dlsym(nvml_so, #x); \
+		if(!x) \
+			throw std::runtime_error("Can't load function ##x"); \
+	} while(0);
+
+		LOAD_SYMBOL(nvmlInit_v2);
+		LOAD_SYMBOL(nvmlShutdown);
+		LOAD_SYMBOL(nvmlDeviceGetCount_v2);
+		LOAD_SYMBOL(nvmlDeviceGetHandleByIndex_v2);
+		LOAD_SYMBOL(nvmlDeviceGetName);
+		LOAD_SYMBOL(nvmlDeviceGetPowerManagementDefaultLimit);
+		LOAD_SYMBOL(nvmlDeviceGetPowerManagementLimit);
+		LOAD_SYMBOL(nvmlDeviceGetFanSpeed);
+		LOAD_SYMBOL(nvmlDeviceGetTemperature);
+		LOAD_SYMBOL(nvmlDeviceGetPowerUsage);
+		LOAD_SYMBOL(nvmlDeviceSetPowerManagementLimit);
+		LOAD_SYMBOL(nvmlErrorString);
+
+#define	LOAD_SYMBOL_OPT(x) \
+	do { \
+		x = (fp_##x)dlsym(nvml_so, #x); \
+	} while(0);
+
+		LOAD_SYMBOL_OPT(nvmlDeviceGetFieldValues);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetPowerManagementLimitConstraints);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetClockInfo);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetUtilizationRates);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetUUID);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetSupportedMemoryClocks);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetSupportedGraphicsClocks);
+		LOAD_SYMBOL_OPT(nvmlDeviceSetGpuLockedClocks);
+		LOAD_SYMBOL_OPT(nvmlDeviceResetGpuLockedClocks);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetTotalEnergyConsumption);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetProcessUtilization);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetNumFans);
+		LOAD_SYMBOL_OPT(nvmlDeviceGetMinMaxFanSpeed);
+		LOAD_SYMBOL_OPT(nvmlDeviceSetFanSpeed_v2);
+		LOAD_SYMBOL_OPT(nvmlDeviceSetDefaultFanSpeed_v2);
+		// same layout of nvmlProcessInfo_t
+		nvmlDeviceGetComputeRunningProcesses = (fp_nvmlDeviceGetRunningProcesses)dlsym(nvml_so, "nvmlDeviceGetComputeRunningProcesses_v3");
+		if(!nvmlDeviceGetComputeRunningProcesses)
+			nvmlDeviceGetComputeRunningProcesses = (fp_nvmlDeviceGetRunningProcesses)dlsym(nvml_so, "nvmlDeviceGetComputeRunningProcesses_v2");
+		nvmlDeviceGetGraphicsRunningProcesses = (fp_nvmlDeviceGetRunningProcesses)dlsym(nvml_so, "nvmlDeviceGetGraphicsRunningProcesses_v3");
+		if(!nvmlDeviceGetGraphicsRunningProcesses)
+			nvmlDeviceGetGraphicsRunningProcesses = (fp_nvmlDeviceGetRunningProcesses)dlsym(nvml_so, "nvmlDeviceGetGraphicsRunningProcesses_v2");
+
+#undef	LOAD_SYMBOL_OPT
+#undef	LOAD_SYMBOL
+	}
+
+	int pvt_nvmlDeviceGetFanSpeed(nvmlDevice_t dev, unsigned int* v) {
+		const auto	rv = nvmlDeviceGetFanSpeed(dev, v);
+		if(rv == 999) {
+			// this is NVML_ERROR_UNKNOWN
+			// and is when nvidia-settings instead
+			// is able to report 125% fan speed
+			// then modify the value and return
+			*v = 125;
+			return 0;
+		}
+		return rv;
+	}
+
+	unsigned int get_device_count(const bool verbose) {
+		unsigned int	max_gpu = 0;
+		if(const int rv = nvmlDeviceGetCount_v2(&max_gpu))
+			throw std::runtime_error((std::string("nvmlDeviceGetCount_v2 failed: ") + std::to_string(rv)).c_str());
+		if(verbose)
+			std::cerr << "Found " << max_gpu << " Nvidia GPUs" << std::endl;
+		if(max_gpu < 1)
+			throw std::runtime_error("Can't find any Nvidia GPU on this system");
+		return max_gpu;
+	}
+
+	nvmlDevice_t get_device_by_id(const unsigned int id, const unsigned int max_gpu) {
+		if(id >= max_gpu)
+			throw std::runtime_error((std::string("Specified gpu id (") + std::to_string(id) + ") outside of max gpu available (" + std::to_string(max_gpu) + ")").c_str());
+		nvmlDevice_t	dev;
+		if(const int rv = nvmlDeviceGetHandleByIndex_v2(id, &dev))
+			throw std::runtime_error((std::string("nvmlDeviceGetHandleByIndex_v2 failed: ") + std::to_string(rv)).c_str());
+		return dev;
+	}
+
+	bool get_running_pids(const nvmlDevice_t dev, std::vector<nvmlProcessInfo_t>& buf, std::vector<unsigned int>& pids) {
+		// NVML_ERROR_INSUFFICIENT_SIZE
+		const int					INSUFFICIENT_SIZE = 7;
+		bool						ok = false;
+		const fp_nvmlDeviceGetRunningProcesses	fns[] = { nvmlDeviceGetComputeRunningProcesses, nvmlDeviceGetGraphicsRunningProcesses };
+		if(buf.empty())
+			buf.resize(64);
+		for(const auto fn : fns) {
+			if(!fn)
+				continue;
+			unsigned int	n = buf.size();
+			int		rv = fn(dev, &n, &buf[0]);
+			if(rv == INSUFFICIENT_SIZE) {
+				buf.resize(n + 16);
+				n = buf.size();
+				rv = fn(dev, &n, &buf[0]);
+			}
+			if(rv)
+				continue;
+			for(unsigned int i = 0; i < n && i < buf.size(); ++i)
+				pids.push_back(buf[i].pid);
+			ok = true;
+		}
+		return ok;
+	}
+
+	namespace {
+		unsigned long long fv_value(const nvmlFieldValue_t& v) {
+			// nvmlValueType_t
+			switch(v.valueType) {
+			case 0:
+				return static_cast<unsigned long long>(v.value.dVal);
+			case 1:
+				return v.value.uiVal;
+			case 2:
+				return v.value.ulVal;
+			case 3:
+				return v.value.ullVal;
+			case 4:
+				return v.value.sllVal;
+			case 5:
+				return v.value.siVal;
+			case 6:
+				return v.value.usVal;
+			default:
+				break;
+			}
+			return 0;
+		}
+
+		nvmlFieldValue_t fv_init(const unsigned int id) {
+			nvmlFieldValue_t	rv;
+			std::memset(&rv, 0x00, sizeof(rv));
+			rv.fieldId = id;
+			return rv;
+		}
+	}
+
+	sampler::sampler(const nvmlDevice_t dev, const bool verbose) : dev_(dev), batched_(false), perf_(false), energy_(false) {
+		if(nvmlDeviceGetClockInfo && nvmlDeviceGetUtilizationRates) {
+			unsigned int		clk = 0;
+			nvmlUtilization_t	u;
+			perf_ = !nvmlDeviceGetClockInfo(dev_, CLOCK_SM, &clk) && !nvmlDeviceGetUtilizationRates(dev_, &u);
+		}
+		// read on its own unless batched
+		if(nvmlDeviceGetTotalEnergyConsumption) {
+			unsigned long long	e = 0;
+			energy_ = !nvmlDeviceGetTotalEnergyConsumption(dev_, &e);
+		}
+		if(!nvmlDeviceGetFieldValues)
+			return;
+		// probe which fields are supported, power has to
+		// be, else there's no point in batching; average
+		// power is what nvmlDeviceGetPowerUsage reports on
+		// newer boards, instant power on older ones
+		nvmlFieldValue_t	probe[] = {
+			fv_init(FI_DEV_POWER_AVERAGE),
+			fv_init(FI_DEV_POWER_INSTANT),
+			fv_init(FI_DEV_MEMORY_TEMP),
+			fv_init(FI_DEV_TOTAL_ENERGY_CONSUMPTION)
+		};
+		const int		n_probe = sizeof(probe)/sizeof(probe[0]);
+		if(nvmlDeviceGetFieldValues(dev_, n_probe, probe))
+			return;
+		if(!probe[0].nvmlReturn)
+			fv_.push_back(fv_init(FI_DEV_POWER_AVERAGE));
+		else if(!probe[1].nvmlReturn)
+			fv_.push_back(fv_init(FI_DEV_POWER_INSTANT));
+		else
+			return;
+		for(int i = 2; i < n_probe; ++i)
+			if(!probe[i].nvmlReturn)
+				fv_.push_back(fv_init(probe[i].fieldId));
+		batched_ = true;
+		if(!probe[3].nvmlReturn)
+			energy_ = false;
+		if(verbose)
+			std::cerr << "Batching " << fv_.size() << " sensors in nvmlDeviceGetFieldValues" << std::endl;
+	}
+
+	void sampler::read(sample& s, const bool perf) {
+		SAFE_NVML_CALL(pvt_nvmlDeviceGetFanSpeed(dev_, &s.fan_speed));
+		SAFE_NVML_CALL(nvmlDeviceGetTemperature(dev_, 0, &s.gpu_temp));
+		// fields a board lacks read as 0
+		s.mem_temp = 0;
+		s.energy_mj = 0;
+		s.has_mem_temp = s.has_energy = false;
+		s.has_perf = perf && perf_;
+		if(s.has_perf) {
+			nvmlUtilization_t	u;
+			SAFE_NVML_CALL(nvmlDeviceGetClockInfo(dev_, CLOCK_SM, &s.sm_clock));
+			SAFE_NVML_CALL(nvmlDeviceGetUtilizationRates(dev_, &u));
+			s.gpu_util = u.gpu;
+		} else {
+			s.sm_clock = s.gpu_util = 0;
+		}
+		if(energy_) {
+			SAFE_NVML_CALL(nvmlDeviceGetTotalEnergyConsumption(dev_, &s.energy_mj));
+			s.has_energy = true;
+		}
+		if(!batched_) {
+			SAFE_NVML_CALL(nvmlDeviceGetPowerUsage(dev_, &s.gpu_pwr));
+			return;
+		}
+		SAFE_NVML_CALL(nvmlDeviceGetFieldValues(dev_, fv_.size(), &fv_[0]));
+		// first field is always power
+		if(fv_[0].nvmlReturn)
+			throw std::runtime_error((std::string("nvmlDeviceGetFieldValues power field failed, error (") + std::to_string(fv_[0].nvmlReturn) + "): " + nvmlErrorString(fv_[0].nvmlReturn)).c_str());
+		s.gpu_pwr = fv_value(fv_[0]);
+		for(size_t i = 1; i < fv_.size(); ++i) {
+			if(fv_[i].nvmlReturn)
+				continue;
+			switch(fv_[i].fieldId) {
+			case FI_DEV_MEMORY_TEMP:
+				s.mem_temp = fv_value(fv_[i]);
+				s.has_mem_temp = true;
+				break;
+			case FI_DEV_TOTAL_ENERGY_CONSUMPTION:
+				s.energy_mj = fv_value(fv_[i]);
+				s.has_energy = true;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,244 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _NVML_H_
+#define _NVML_H_
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "lat.h"
+
+namespace nvml {
+	extern const char	SO_NAME[];
+
+	// types definitions (compatible)
+	typedef void*	nvmlDevice_t;
+
+	typedef union {
+		double			dVal;
+		int			siVal;
+		unsigned int		uiVal;
+		unsigned long		ulVal;
+		unsigned long long	ullVal;
+		signed long long	sllVal;
+		unsigned short		usVal;
+	} nvmlValue_t;
+
+	typedef struct {
+		unsigned int	fieldId;
+		unsigned int	scopeId;
+		long long	timestamp;
+		long long	latencyUsec;
+		int		valueType;
+		int		nvmlReturn;
+		nvmlValue_t	value;
+	} nvmlFieldValue_t;
+
+	typedef struct {
+		unsigned int	gpu;
+		unsigned int	memory;
+	} nvmlUtilization_t;
+
+	// nvmlProcessInfo_v2_t, as used by the _v2
+	// and _v3 process queries
+	typedef struct {
+		unsigned int		pid;
+		unsigned long long	usedGpuMemory;
+		unsigned int		gpuInstanceId;
+		unsigned int		computeInstanceId;
+	} nvmlProcessInfo_t;
+
+	typedef struct {
+		unsigned int		pid;
+		unsigned long long	timeStamp;
+		unsigned int		smUtil,
+					memUtil,
+					encUtil,
+					decUtil;
+	} nvmlProcessUtilizationSample_t;
+
+	// subset of nvmlClockType_t
+	enum clock_type {
+		CLOCK_SM = 1
+	};
+
+	// subset of nvmlReturn_t
+	enum return_code {
+		ERROR_NOT_SUPPORTED = 3,
+		ERROR_NO_PERMISSION = 4
+	};
+
+	// thrown by SAFE_NVML_CALL, keeps the return code
+	class error : public std::runtime_error {
+		const int	rv_;
+	public:
+		error(const std::string& what, const int rv) : std::runtime_error(what), rv_(rv) {
+		}
+
+		int code(void) const {
+			return rv_;
+		}
+
+		// retrying won't help (i.e. not root)
+		bool permanent(void) const {
+			return rv_ == ERROR_NOT_SUPPORTED || rv_ == ERROR_NO_PERMISSION;
+		}
+	};
+
+	// subset of field ids (NVML_FI_*)
+	enum field_id {
+		FI_DEV_MEMORY_TEMP = 82,
+		FI_DEV_TOTAL_ENERGY_CONSUMPTION = 83,
+		FI_DEV_POWER_AVERAGE = 185,
+		FI_DEV_POWER_INSTANT = 186
+	};
+
+	// function pointers definitions
+	typedef int (*fp_nvmlInit_v2)(void);
+	typedef int (*fp_nvmlShutdown)(void);
+	typedef int (*fp_nvmlDeviceGetCount_v2)(unsigned int*);
+	typedef int (*fp_nvmlDeviceGetHandleByIndex_v2)(unsigned int, nvmlDevice_t*);
+	typedef int (*fp_nvmlDeviceGetName)(nvmlDevice_t, char*, unsigned int);
+	typedef int (*fp_nvmlDeviceGetPowerManagementDefaultLimit)(nvmlDevice_t, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetPowerManagementLimit)(nvmlDevice_t, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetFanSpeed)(nvmlDevice_t, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetTemperature)(nvmlDevice_t, const int, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetPowerUsage)(nvmlDevice_t, unsigned int*);
+	typedef int (*fp_nvmlDeviceSetPowerManagementLimit)(nvmlDevice_t, unsigned int);
+	typedef const char* (*fp_nvmlErrorString)(int);
+	// optional functions
+	typedef int (*fp_nvmlDeviceGetFieldValues)(nvmlDevice_t, int, nvmlFieldValue_t*);
+	typedef int (*fp_nvmlDeviceGetPowerManagementLimitConstraints)(nvmlDevice_t, unsigned int*, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetClockInfo)(nvmlDevice_t, int, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetUtilizationRates)(nvmlDevice_t, nvmlUtilization_t*);
+	typedef int (*fp_nvmlDeviceGetRunningProcesses)(nvmlDevice_t, unsigned int*, nvmlProcessInfo_t*);
+	typedef int (*fp_nvmlDeviceGetUUID)(nvmlDevice_t, char*, unsigned int);
+	typedef int (*fp_nvmlDeviceGetSupportedMemoryClocks)(nvmlDevice_t, unsigned int*, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetSupportedGraphicsClocks)(nvmlDevice_t, unsigned int, unsigned int*, unsigned int*);
+	typedef int (*fp_nvmlDeviceSetGpuLockedClocks)(nvmlDevice_t, unsigned int, unsigned int);
+	typedef int (*fp_nvmlDeviceResetGpuLockedClocks)(nvmlDevice_t);
+	typedef int (*fp_nvmlDeviceGetTotalEnergyConsumption)(nvmlDevice_t, unsigned long long*);
+	typedef int (*fp_nvmlDeviceGetProcessUtilization)(nvmlDevice_t, nvmlProcessUtilizationSample_t*, unsigned int*, unsigned long long);
+	typedef int (*fp_nvmlDeviceGetNumFans)(nvmlDevice_t, unsigned int*);
+	typedef int (*fp_nvmlDeviceGetMinMaxFanSpeed)(nvmlDevice_t, unsigned int*, unsigned int*);
+	typedef int (*fp_nvmlDeviceSetFanSpeed_v2)(nvmlDevice_t, unsigned int, unsigned int);
+	typedef int (*fp_nvmlDeviceSetDefaultFanSpeed_v2)(nvmlDevice_t, unsigned int);
+
+	// functions themselves
+	extern fp_nvmlInit_v2					nvmlInit_v2;
+	extern fp_nvmlShutdown					nvmlShutdown;
+	extern fp_nvmlDeviceGetCount_v2				nvmlDeviceGetCount_v2;
+	extern fp_nvmlDeviceGetHandleByIndex_v2			nvmlDeviceGetHandleByIndex_v2;
+	extern fp_nvmlDeviceGetName				nvmlDeviceGetName;
+	extern fp_nvmlDeviceGetPowerManagementDefaultLimit	nvmlDeviceGetPowerManagementDefaultLimit;
+	extern fp_nvmlDeviceGetPowerManagementLimit		nvmlDeviceGetPowerManagementLimit;
+	extern fp_nvmlDeviceGetFanSpeed				nvmlDeviceGetFanSpeed;
+	extern fp_nvmlDeviceGetTemperature			nvmlDeviceGetTemperature;
+	extern fp_nvmlDeviceGetPowerUsage			nvmlDeviceGetPowerUsage;
+	extern fp_nvmlDeviceSetPowerManagementLimit		nvmlDeviceSetPowerManagementLimit;
+	extern fp_nvmlErrorString				nvmlErrorString;
+	// these may be null when not exported
+	// by the loaded NVML
+	extern fp_nvmlDeviceGetFieldValues			nvmlDeviceGetFieldValues;
+	extern fp_nvmlDeviceGetPowerManagementLimitConstraints	nvmlDeviceGetPowerManagementLimitConstraints;
+	extern fp_nvmlDeviceGetClockInfo			nvmlDeviceGetClockInfo;
+	extern fp_nvmlDeviceGetUtilizationRates			nvmlDeviceGetUtilizationRates;
+	// _v3 when exported, else _v2
+	extern fp_nvmlDeviceGetRunningProcesses			nvmlDeviceGetComputeRunningProcesses;
+	extern fp_nvmlDeviceGetRunningProcesses			nvmlDeviceGetGraphicsRunningProcesses;
+	extern fp_nvmlDeviceGetUUID				nvmlDeviceGetUUID;
+	extern fp_nvmlDeviceGetSupportedMemoryClocks		nvmlDeviceGetSupportedMemoryClocks;
+	extern fp_nvmlDeviceGetSupportedGraphicsClocks		nvmlDeviceGetSupportedGraphicsClocks;
+	extern fp_nvmlDeviceSetGpuLockedClocks			nvmlDeviceSetGpuLockedClocks;
+	extern fp_nvmlDeviceResetGpuLockedClocks		nvmlDeviceResetGpuLockedClocks;
+	extern fp_nvmlDeviceGetTotalEnergyConsumption		nvmlDeviceGetTotalEnergyConsumption;
+	extern fp_nvmlDeviceGetProcessUtilization		nvmlDeviceGetProcessUtilization;
+	extern fp_nvmlDeviceGetNumFans				nvmlDeviceGetNumFans;
+	extern fp_nvmlDeviceGetMinMaxFanSpeed			nvmlDeviceGetMinMaxFanSpeed;
+	extern fp_nvmlDeviceSetFanSpeed_v2			nvmlDeviceSetFanSpeed_v2;
+	extern fp_nvmlDeviceSetDefaultFanSpeed_v2		nvmlDeviceSetDefaultFanSpeed_v2;
+
+	extern void load_functions(void* nvml_so);
+
+	extern int pvt_nvmlDeviceGetFanSpeed(nvmlDevice_t dev, unsigned int* v);
+
+	// all these functions require 'load_functions'
+	// to be called
+	extern unsigned int get_device_count(const bool verbose);
+
+	extern nvmlDevice_t get_device_by_id(const unsigned int id, const unsigned int max_gpu);
+
+	// appends the pids of the compute and graphics
+	// processes running on dev, buf is grown as needed;
+	// returns false when none of the queries worked
+	extern bool get_running_pids(const nvmlDevice_t dev, std::vector<nvmlProcessInfo_t>& buf, std::vector<unsigned int>& pids);
+
+	// one reading of all the sensors of a device;
+	// sm_clock (MHz) and gpu_util (%) are only read
+	// when asked for, energy_mj is the total energy
+	// counter of the board
+	struct sample {
+		unsigned int		fan_speed,
+					gpu_temp,
+					gpu_pwr,
+					mem_temp,
+					sm_clock,
+					gpu_util;
+		unsigned long long	energy_mj;
+		bool			has_mem_temp,
+					has_energy,
+					has_perf;
+	};
+
+	// reads all the sensors of a device each tick, batching
+	// everything possible in a single nvmlDeviceGetFieldValues
+	// call, falling back to one call per sensor when not
+	// available. Please note there are no field ids for
+	// fan speed and GPU temperature, hence those always
+	// need their own call
+	class sampler {
+		const nvmlDevice_t		dev_;
+		std::vector<nvmlFieldValue_t>	fv_;
+		bool				batched_,
+						perf_,
+						energy_;
+	public:
+		sampler(const nvmlDevice_t dev, const bool verbose);
+
+		// perf also reads SM clock and utilization,
+		// when the board reports them
+		void read(sample& s, const bool perf);
+
+		bool batched(void) const {
+			return batched_;
+		}
+	};
+}
+
+// also times each call site, see lat.h
+#define SAFE_NVML_CALL(x) \
+	do { \
+		static const size_t lat_site = lat::site(#x); \
+		const uint64_t lat_t0 = lat::now_ns(); \
+		const int rv = (x); \
+		lat::record(lat_site, lat::now_ns() - lat_t0); \
+		if(rv) \
+			throw nvml::error(std::string(#x) + " failed, error (" + std::to_string(rv) + "): " + nvml::nvmlErrorString(rv), rv); \
+	} while(0);
+
+#endif //_NVML_H_
@@ -0,0 +1,883 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+// Stand-in for libnvidia-ml.so, implementing the NVML
+// symbols nv-pwr-ctrl uses on top of a simulated GPU:
+// a power -> temperature RC model, a fan curve and a
+// workload trace driving the power demand.
+// All the settings are read from NVSIM_* environment
+// variables when nvmlInit_v2 is invoked.
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+#include <time.h>
+#include "nvml.h"
+
+namespace {
+	// subset of nvmlReturn_t
+	enum {
+		NVML_SUCCESS = 0,
+		NVML_ERROR_UNINITIALIZED = 1,
+		NVML_ERROR_INVALID_ARGUMENT = 2,
+		NVML_ERROR_NOT_SUPPORTED = 3,
+		NVML_ERROR_NO_PERMISSION = 4,
+		NVML_ERROR_NOT_FOUND = 6,
+		NVML_ERROR_INSUFFICIENT_SIZE = 7,
+		NVML_ERROR_FUNCTION_NOT_FOUND = 13,
+		NVML_ERROR_UNKNOWN = 999
+	};
+
+	std::string env_str(const char* name, const char* def) {
+		const char	*v = std::getenv(name);
+		return (v && *v) ? v : def;
+	}
+
+	double env_dbl(const char* name, const double def) {
+		const char	*v = std::getenv(name);
+		return (v && *v) ? std::atof(v) : def;
+	}
+
+	// piecewise linear function, x has to be sorted
+	struct pwl {
+		std::vector<std::pair<double, double>>	pts;
+
+		double operator()(const double x) const {
+			if(pts.empty())
+				return 0.0;
+			if(x <= pts.front().first)
+				return pts.front().second;
+			for(size_t i = 1; i < pts.size(); ++i) {
+				if(x > pts[i].first)
+					continue;
+				const auto&	a = pts[i-1];
+				const auto&	b = pts[i];
+				return a.second + (b.second - a.second)*(x - a.first)/(b.first - a.first);
+			}
+			return pts.back().second;
+		}
+
+		// parses "x0:y0,x1:y1,..."
+		static pwl parse(const std::string& s) {
+			pwl			rv;
+			std::istringstream	iss(s);
+			std::string		tok;
+			while(std::getline(iss, tok, ',')) {
+				const auto	p = tok.find(':');
+				if(p == std::string::npos)
+					throw std::runtime_error((std::string("Invalid NVSIM curve point: '") + tok + "'").c_str());
+				rv.pts.push_back(std::make_pair(std::atof(tok.substr(0, p).c_str()), std::atof(tok.substr(p+1).c_str())));
+			}
+			return rv;
+		}
+	};
+
+	// power demand (W) as a function of simulated time (s)
+	struct workload {
+		enum type {
+			CONST = 0,
+			SQUARE,
+			TRACE
+		}		t;
+		double		hi_w,
+				lo_w,
+				half_period_s;
+		pwl		trace;
+		double		trace_len_s;
+
+		double operator()(const double s) const {
+			switch(t) {
+			case SQUARE:
+				return (static_cast<long long>(s/half_period_s)%2) ? lo_w : hi_w;
+			case TRACE:
+				// loop over the trace as a step function
+				return trace_len_s > 0.0 ? trace(std::fmod(s, trace_len_s)) : trace(s);
+			case CONST:
+			default:
+				break;
+			}
+			return hi_w;
+		}
+
+		// "const:W", "square:hiW:loW:half_period_s"
+		// or "file:path" with "seconds,watts" lines
+		static workload parse(const std::string& s) {
+			workload	rv = { CONST, 220.0, 0.0, 1.0, pwl(), 0.0 };
+			if(!s.compare(0, 6, "const:")) {
+				rv.hi_w = std::atof(s.c_str() + 6);
+			} else if(!s.compare(0, 7, "square:")) {
+				rv.t = SQUARE;
+				if(3 != std::sscanf(s.c_str() + 7, "%lf:%lf:%lf", &rv.hi_w, &rv.lo_w, &rv.half_period_s) || rv.half_period_s <= 0.0)
+					throw std::runtime_error((std::string("Invalid NVSIM_WORKLOAD: '") + s + "'").c_str());
+			} else if(!s.compare(0, 5, "file:")) {
+				rv.t = TRACE;
+				std::ifstream	istr(s.substr(5).c_str());
+				if(!istr)
+					throw std::runtime_error((std::string("Can't open NVSIM_WORKLOAD trace: '") + s.substr(5) + "'").c_str());
+				std::string	line;
+				while(std::getline(istr, line)) {
+					double	t = 0.0,
+						w = 0.0;
+					if(line.empty() || line[0] == '#' || 2 != std::sscanf(line.c_str(), "%lf,%lf", &t, &w))
+						continue;
+					// step function: hold the previous value
+					// until the next point
+					if(!rv.trace.pts.empty())
+						rv.trace.pts.push_back(std::make_pair(t - 1e-6, rv.trace.pts.back().second));
+					rv.trace.pts.push_back(std::make_pair(t, w));
+				}
+				if(rv.trace.pts.empty())
+					throw std::runtime_error((std::string("Empty NVSIM_WORKLOAD trace: '") + s.substr(5) + "'").c_str());
+				rv.trace_len_s = rv.trace.pts.back().first;
+			} else {
+				throw std::runtime_error((std::string("Invalid NVSIM_WORKLOAD: '") + s + "'").c_str());
+			}
+			return rv;
+		}
+	};
+
+	struct config {
+		unsigned int	n_gpus;
+		std::string	name;
+		double		default_limit_w,
+				min_limit_w,
+				max_limit_w,
+				idle_w,
+				ambient_c,
+				init_c,
+				thermal_r,
+				thermal_c,
+				fan_cooling,
+				fan_rate,
+				fan_max,
+				fan_min,
+				pwr_tau_s,
+				noise_w,
+				call_latency_us,
+				set_latency_ms,
+				set_fail_pct,
+				time_scale,
+				target_temp,
+				target_fan,
+				static_w,
+				max_clock_mhz,
+				idle_clock_mhz;
+		pwl		fan_curve;
+		workload	wl;
+		// per GPU, NVSIM_WORKLOAD_<id> when set
+		std::vector<workload>	gpu_wl;
+		std::string	procs_file;
+		bool		report,
+				require_root,
+				energy,
+				fan_ctl;
+	};
+
+	// simulated GPU
+	struct gpu {
+		unsigned int	id;
+		std::mutex	mtx;
+		workload	wl;
+		// physical state
+		double		t_s,
+				temp_c,
+				fan_pct,
+				pwr_w,
+				limit_w,
+				// max locked clock, 0 when unlocked
+				lock_mhz,
+				// manual fan speed, negative when
+				// following the fan curve
+				fan_duty;
+		unsigned int	rnd;
+		// statistics
+		double		energy_j,
+				clock_s,
+				limit_s,
+				temp_above_s,
+				fan_above_s,
+				temp_last_above_s,
+				fan_last_above_s,
+				max_temp_c,
+				max_fan_pct;
+		size_t		n_sets,
+				n_set_calls;
+	};
+
+	const double		STEP_S = 0.01,
+				// clocks settle way faster than the
+				// firmware power loop
+				CLK_TAU_S = 0.02,
+				MEM_CLOCK_MHZ = 5001.0,
+				CLOCK_STEP_MHZ = 15.0;
+
+	bool			init = false;
+	config			cfg;
+	std::vector<gpu*>	gpus;
+	std::chrono::steady_clock::time_point	t_start;
+	// simulated seconds once nvsimAdvance has been
+	// invoked, negative while following the wall clock
+	double			manual_s = -1.0;
+
+	config load_config(void) {
+		config	c;
+		c.n_gpus = static_cast<unsigned int>(env_dbl("NVSIM_GPUS", 1));
+		c.name = env_str("NVSIM_NAME", "NVSIM Simulated GPU");
+		c.default_limit_w = env_dbl("NVSIM_DEFAULT_LIMIT_W", 250.0);
+		c.min_limit_w = env_dbl("NVSIM_MIN_LIMIT_W", 100.0);
+		c.max_limit_w = env_dbl("NVSIM_MAX_LIMIT_W", c.default_limit_w);
+		c.idle_w = env_dbl("NVSIM_IDLE_W", 20.0);
+		c.ambient_c = env_dbl("NVSIM_AMBIENT_C", 25.0);
+		c.init_c = env_dbl("NVSIM_INIT_C", c.ambient_c + 10.0);
+		// thermal resistance (C/W) with fans still and
+		// how much the fans at 100% improve it, i.e.
+		// R(fan) = R / (1 + cooling*fan/100)
+		c.thermal_r = env_dbl("NVSIM_THERMAL_R", 0.6);
+		c.fan_cooling = env_dbl("NVSIM_FAN_COOLING", 1.5);
+		// thermal capacity (J/C)
+		c.thermal_c = env_dbl("NVSIM_THERMAL_C", 120.0);
+		// fan curve (C:%) and max fan change (%/s)
+		c.fan_curve = pwl::parse(env_str("NVSIM_FAN_CURVE", "40:30,60:45,75:70,85:100"));
+		c.fan_rate = env_dbl("NVSIM_FAN_RATE", 5.0);
+		// fan speeds above 100% get reported as NVML_ERROR_UNKNOWN
+		// as some boards do (i.e. nvidia-settings reporting 125%)
+		c.fan_max = env_dbl("NVSIM_FAN_MAX", 100.0);
+		// lowest manual fan speed accepted
+		c.fan_min = env_dbl("NVSIM_FAN_MIN", 30.0);
+		// firmware power loop time constant
+		c.pwr_tau_s = env_dbl("NVSIM_PWR_TAU_S", 0.5);
+		c.noise_w = env_dbl("NVSIM_NOISE_W", 0.0);
+		// emulates the cost of each driver round trip
+		c.call_latency_us = env_dbl("NVSIM_CALL_LATENCY_US", 0.0);
+		// setters only, on top of the above: slow and
+		// flaky privileged calls
+		c.set_latency_ms = env_dbl("NVSIM_SET_LATENCY_MS", 0.0);
+		c.set_fail_pct = env_dbl("NVSIM_SET_FAIL_PCT", 0.0);
+		c.time_scale = env_dbl("NVSIM_TIME_SCALE", 1.0);
+		c.target_temp = env_dbl("NVSIM_TARGET_TEMP", 80.0);
+		c.target_fan = env_dbl("NVSIM_TARGET_FAN", 80.0);
+		c.wl = workload::parse(env_str("NVSIM_WORKLOAD", "const:250"));
+		// power not scaling with clocks (leakage, memory, ...),
+		// the rest scales with the cube of the SM clock
+		c.static_w = env_dbl("NVSIM_STATIC_W", 80.0);
+		c.max_clock_mhz = env_dbl("NVSIM_MAX_CLOCK_MHZ", 1950.0);
+		c.idle_clock_mhz = env_dbl("NVSIM_IDLE_CLOCK_MHZ", 300.0);
+		// pids (one per line) reported as running on
+		// all the GPUs, read at every query
+		c.procs_file = env_str("NVSIM_PROCS_FILE", "");
+		c.report = env_dbl("NVSIM_REPORT", 0.0) != 0.0;
+		c.require_root = env_dbl("NVSIM_REQUIRE_ROOT", 0.0) != 0.0;
+		// boards without the total energy counter
+		c.energy = env_dbl("NVSIM_ENERGY", 1.0) != 0.0;
+		// boards whose fans can't be set
+		c.fan_ctl = env_dbl("NVSIM_FAN_CTL", 1.0) != 0.0;
+		for(unsigned int i = 0; i < c.n_gpus; ++i) {
+			const std::string	wl_i = env_str(("NVSIM_WORKLOAD_" + std::to_string(i)).c_str(), "");
+			c.gpu_wl.push_back(wl_i.empty() ? c.wl : workload::parse(wl_i));
+		}
+		if(c.n_gpus < 1 || c.min_limit_w > c.max_limit_w || c.default_limit_w > c.max_limit_w || c.time_scale <= 0.0 || c.thermal_c <= 0.0)
+			throw std::runtime_error("Invalid NVSIM configuration");
+		return c;
+	}
+
+	double sim_now(void) {
+		if(manual_s >= 0.0)
+			return manual_s;
+		const std::chrono::duration<double>	d = std::chrono::steady_clock::now() - t_start;
+		return d.count()*cfg.time_scale;
+	}
+
+	double sm_clock(const gpu& g);
+
+	// advances the simulation of g up to the current time
+	void advance(gpu& g) {
+		const double	now = sim_now();
+		while(g.t_s + STEP_S <= now) {
+			// power follows the demand, capped by the limit
+			double		demand = g.wl(g.t_s);
+			if(demand < cfg.idle_w)
+				demand = cfg.idle_w;
+			double		tgt_pwr = (demand > g.limit_w) ? g.limit_w : demand,
+					tau_s = cfg.pwr_tau_s;
+			// and by the locked clock, via the cube law
+			if(g.lock_mhz > 0.0 && g.lock_mhz < cfg.max_clock_mhz && demand > cfg.static_w) {
+				const double	f = g.lock_mhz/cfg.max_clock_mhz,
+				      		lock_pwr = cfg.static_w + (demand - cfg.static_w)*f*f*f;
+				if(lock_pwr < tgt_pwr) {
+					tgt_pwr = lock_pwr;
+					tau_s = CLK_TAU_S;
+				}
+			}
+			g.pwr_w += (tgt_pwr - g.pwr_w)*STEP_S/(tau_s + STEP_S);
+			// RC thermal model
+			const double	r = cfg.thermal_r/(1.0 + cfg.fan_cooling*g.fan_pct/100.0);
+			g.temp_c += (g.pwr_w - (g.temp_c - cfg.ambient_c)/r)*STEP_S/cfg.thermal_c;
+			// fan follows the curve with a max slew rate
+			const double	tgt_fan = (g.fan_duty < 0.0) ? cfg.fan_curve(g.temp_c) : g.fan_duty,
+					max_df = cfg.fan_rate*STEP_S;
+			double		df = tgt_fan - g.fan_pct;
+			if(df > max_df) df = max_df;
+			else if(df < -max_df) df = -max_df;
+			g.fan_pct += df;
+			if(g.fan_pct > cfg.fan_max)
+				g.fan_pct = cfg.fan_max;
+			// stats
+			g.t_s += STEP_S;
+			g.energy_j += g.pwr_w*STEP_S;
+			g.clock_s += sm_clock(g)*STEP_S;
+			g.limit_s += g.limit_w*STEP_S;
+			if(g.temp_c > cfg.target_temp) {
+				g.temp_above_s += STEP_S;
+				g.temp_last_above_s = g.t_s;
+			}
+			if(g.fan_pct > cfg.target_fan) {
+				g.fan_above_s += STEP_S;
+				g.fan_last_above_s = g.t_s;
+			}
+			if(g.temp_c > g.max_temp_c)
+				g.max_temp_c = g.temp_c;
+			if(g.fan_pct > g.max_fan_pct)
+				g.max_fan_pct = g.fan_pct;
+		}
+	}
+
+	double noise(gpu& g) {
+		if(cfg.noise_w <= 0.0)
+			return 0.0;
+		// simple LCG, to stay deterministic across runs
+		g.rnd = g.rnd*1103515245 + 12345;
+		return cfg.noise_w*(((g.rnd >> 16)&0x7FFF)/16383.5 - 1.0);
+	}
+
+	// settling time is the last time the signal
+	// has been above target (0 if never)
+	void report(const gpu& g) {
+		std::fprintf(stderr, "nvsim gpu=%u sim_s=%.2f energy_j=%.1f avg_pwr_w=%.2f avg_limit_w=%.2f limit_sets=%zu avg_clock_mhz=%.1f mhz_per_w=%.3f "
+				"max_temp_c=%.2f temp_overshoot_c=%.2f temp_above_s=%.2f temp_settle_s=%.2f "
+				"max_fan_pct=%.2f fan_overshoot_pct=%.2f fan_above_s=%.2f fan_settle_s=%.2f\n",
+				g.id, g.t_s, g.energy_j, (g.t_s > 0.0) ? g.energy_j/g.t_s : 0.0, (g.t_s > 0.0) ? g.limit_s/g.t_s : 0.0, g.n_sets,
+				(g.t_s > 0.0) ? g.clock_s/g.t_s : 0.0, (g.energy_j > 0.0) ? g.clock_s/g.energy_j : 0.0,
+				g.max_temp_c, (g.max_temp_c > cfg.target_temp) ? g.max_temp_c - cfg.target_temp : 0.0, g.temp_above_s, g.temp_last_above_s,
+				g.max_fan_pct, (g.max_fan_pct > cfg.target_fan) ? g.max_fan_pct - cfg.target_fan : 0.0, g.fan_above_s, g.fan_last_above_s);
+	}
+
+	// the workload demand is what the GPU draws at max
+	// clock, when capped the clock drops as the cube root
+	// of the dynamic power, hence clocks per watt peak
+	// at 1.5 times the static power; a locked clock
+	// caps it
+	double sm_clock(const gpu& g) {
+		const double	demand = g.wl(g.t_s);
+		if(demand <= cfg.idle_w)
+			return cfg.idle_clock_mhz;
+		double		clk = cfg.max_clock_mhz;
+		if(demand > cfg.static_w && g.pwr_w < demand) {
+			const double	r = (g.pwr_w - cfg.static_w)/(demand - cfg.static_w);
+			clk *= std::cbrt((r > 0.0) ? r : 0.0);
+		}
+		if(g.lock_mhz > 0.0 && clk > g.lock_mhz)
+			clk = g.lock_mhz;
+		return (clk > cfg.idle_clock_mhz) ? clk : cfg.idle_clock_mhz;
+	}
+
+	void call_latency(void) {
+		if(cfg.call_latency_us <= 0.0)
+			return;
+		const long long		ns = cfg.call_latency_us*1000.0;
+		struct timespec		ts = { static_cast<time_t>(ns/1000000000LL), static_cast<long>(ns%1000000000LL) };
+		nanosleep(&ts, 0);
+	}
+
+	void set_latency(void) {
+		if(cfg.set_latency_ms <= 0.0)
+			return;
+		const long long		ns = cfg.set_latency_ms*1000000.0;
+		struct timespec		ts = { static_cast<time_t>(ns/1000000000LL), static_cast<long>(ns%1000000000LL) };
+		nanosleep(&ts, 0);
+	}
+
+	// evenly spread, hence deterministic
+	bool set_fails(gpu& g) {
+		const size_t	k = g.n_set_calls++;
+		return static_cast<size_t>((k + 1)*cfg.set_fail_pct/100.0) > static_cast<size_t>(k*cfg.set_fail_pct/100.0);
+	}
+
+	struct sim_proc {
+		unsigned int	pid;
+		double		sm_pct,
+				mem_pct;
+	};
+
+	// 'pid [sm% [mem%]]' lines, utilization defaults
+	// to an even share of the GPU one
+	std::vector<sim_proc> read_procs(const gpu& g) {
+		std::vector<sim_proc>	rv;
+		if(cfg.procs_file.empty())
+			return rv;
+		std::ifstream	istr(cfg.procs_file.c_str());
+		std::string	line;
+		while(std::getline(istr, line)) {
+			std::istringstream	iss(line);
+			sim_proc		p = { 0, -1.0, -1.0 };
+			if(!(iss >> p.pid))
+				continue;
+			if(iss >> p.sm_pct)
+				iss >> p.mem_pct;
+			rv.push_back(p);
+		}
+		const bool	busy = g.wl(g.t_s) > cfg.idle_w;
+		for(auto& p : rv) {
+			if(p.sm_pct < 0.0)
+				p.sm_pct = busy ? 100.0/rv.size() : 0.0;
+			if(p.mem_pct < 0.0)
+				p.mem_pct = busy ? 40.0/rv.size() : 0.0;
+		}
+		return rv;
+	}
+
+	gpu* get_gpu(void* dev) {
+		if(!init)
+			return 0;
+		for(auto g : gpus)
+			if(g == dev)
+				return g;
+		return 0;
+	}
+}
+
+#define	SIM_GPU_CALL(dev, g) \
+	gpu	*g = get_gpu(dev); \
+	if(!init) \
+		return NVML_ERROR_UNINITIALIZED; \
+	if(!g) \
+		return NVML_ERROR_INVALID_ARGUMENT; \
+	call_latency(); \
+	std::lock_guard<std::mutex>	l_##g(g->mtx); \
+	advance(*g);
+
+// the GPU isn't locked while the setter is slow
+#define	SIM_SET_CALL(dev, g) \
+	if(init) \
+		set_latency(); \
+	SIM_GPU_CALL(dev, g); \
+	if(cfg.require_root && geteuid()) \
+		return NVML_ERROR_NO_PERMISSION; \
+	if(set_fails(*g)) \
+		return NVML_ERROR_UNKNOWN;
+
+extern "C" {
+
+int nvmlInit_v2(void) {
+	if(init)
+		return NVML_SUCCESS;
+	try {
+		cfg = load_config();
+	} catch(const std::exception& e) {
+		std::cerr << "nvsim: " << e.what() << std::endl;
+		return NVML_ERROR_UNKNOWN;
+	}
+	for(unsigned int i = 0; i < cfg.n_gpus; ++i) {
+		gpu	*g = new gpu;
+		g->id = i;
+		g->wl = cfg.gpu_wl[i];
+		g->t_s = 0.0;
+		g->temp_c = g->max_temp_c = cfg.init_c;
+		g->fan_pct = g->max_fan_pct = cfg.fan_curve(cfg.init_c);
+		g->fan_duty = -1.0;
+		g->pwr_w = cfg.idle_w;
+		g->limit_w = cfg.default_limit_w;
+		g->lock_mhz = 0.0;
+		g->rnd = 1 + i;
+		g->energy_j = g->clock_s = g->limit_s = g->temp_above_s = g->fan_above_s = g->temp_last_above_s = g->fan_last_above_s = 0.0;
+		g->n_sets = g->n_set_calls = 0;
+		gpus.push_back(g);
+	}
+	t_start = std::chrono::steady_clock::now();
+	manual_s = -1.0;
+	init = true;
+	return NVML_SUCCESS;
+}
+
+int nvmlShutdown(void) {
+	if(!init)
+		return NVML_ERROR_UNINITIALIZED;
+	for(auto g : gpus) {
+		{
+			std::lock_guard<std::mutex>	l(g->mtx);
+			advance(*g);
+		}
+		if(cfg.report)
+			report(*g);
+		delete g;
+	}
+	gpus.clear();
+	init = false;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetCount_v2(unsigned int* count) {
+	if(!init)
+		return NVML_ERROR_UNINITIALIZED;
+	if(!count)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*count = gpus.size();
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetHandleByIndex_v2(unsigned int idx, void** dev) {
+	if(!init)
+		return NVML_ERROR_UNINITIALIZED;
+	if(!dev || idx >= gpus.size())
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*dev = gpus[idx];
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetName(void* dev, char* name, unsigned int len) {
+	SIM_GPU_CALL(dev, g);
+	if(!name)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(len < cfg.name.size() + 1)
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	std::strcpy(name, cfg.name.c_str());
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetUUID(void* dev, char* uuid, unsigned int len) {
+	SIM_GPU_CALL(dev, g);
+	if(!uuid || !len)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const std::string	s = "GPU-00000000-0000-0000-0000-nvsim" + std::to_string(g->id);
+	if(len <= s.size())
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	std::strcpy(uuid, s.c_str());
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetPowerManagementDefaultLimit(void* dev, unsigned int* limit) {
+	SIM_GPU_CALL(dev, g);
+	if(!limit)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*limit = static_cast<unsigned int>(cfg.default_limit_w*1000.0);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetPowerManagementLimit(void* dev, unsigned int* limit) {
+	SIM_GPU_CALL(dev, g);
+	if(!limit)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*limit = static_cast<unsigned int>(g->limit_w*1000.0);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetPowerManagementLimitConstraints(void* dev, unsigned int* min_limit, unsigned int* max_limit) {
+	SIM_GPU_CALL(dev, g);
+	if(!min_limit || !max_limit)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*min_limit = static_cast<unsigned int>(cfg.min_limit_w*1000.0);
+	*max_limit = static_cast<unsigned int>(cfg.max_limit_w*1000.0);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetFanSpeed(void* dev, unsigned int* speed) {
+	SIM_GPU_CALL(dev, g);
+	if(!speed)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(g->fan_pct > 100.0)
+		return NVML_ERROR_UNKNOWN;
+	*speed = static_cast<unsigned int>(g->fan_pct + 0.5);
+	return NVML_SUCCESS;
+}
+
+// a single fan, moving at NVSIM_FAN_RATE towards
+// the manual speed as it does towards the curve
+int nvmlDeviceGetNumFans(void* dev, unsigned int* n) {
+	SIM_GPU_CALL(dev, g);
+	if(!n)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(!cfg.fan_ctl)
+		return NVML_ERROR_NOT_SUPPORTED;
+	*n = 1;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetMinMaxFanSpeed(void* dev, unsigned int* min_speed, unsigned int* max_speed) {
+	SIM_GPU_CALL(dev, g);
+	if(!min_speed || !max_speed)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*min_speed = static_cast<unsigned int>(cfg.fan_min);
+	*max_speed = 100;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceSetFanSpeed_v2(void* dev, unsigned int fan, unsigned int speed) {
+	SIM_SET_CALL(dev, g);
+	if(fan != 0 || speed < cfg.fan_min || speed > 100)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	g->fan_duty = speed;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceSetDefaultFanSpeed_v2(void* dev, unsigned int fan) {
+	SIM_SET_CALL(dev, g);
+	if(fan != 0)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	g->fan_duty = -1.0;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetTemperature(void* dev, const int sensor, unsigned int* temp) {
+	SIM_GPU_CALL(dev, g);
+	// only NVML_TEMPERATURE_GPU
+	if(sensor != 0)
+		return NVML_ERROR_NOT_SUPPORTED;
+	if(!temp)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*temp = static_cast<unsigned int>(g->temp_c + 0.5);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetPowerUsage(void* dev, unsigned int* power) {
+	SIM_GPU_CALL(dev, g);
+	if(!power)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const double	p = g->pwr_w + noise(*g);
+	*power = (p > 0.0) ? static_cast<unsigned int>(p*1000.0) : 0;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetClockInfo(void* dev, int type, unsigned int* clock) {
+	SIM_GPU_CALL(dev, g);
+	if(type != nvml::CLOCK_SM)
+		return NVML_ERROR_NOT_SUPPORTED;
+	if(!clock)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	*clock = static_cast<unsigned int>(sm_clock(*g) + 0.5);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetUtilizationRates(void* dev, nvml::nvmlUtilization_t* util) {
+	SIM_GPU_CALL(dev, g);
+	if(!util)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const bool	busy = g->wl(g->t_s) > cfg.idle_w;
+	util->gpu = busy ? 100 : 0;
+	util->memory = busy ? 40 : 0;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetGraphicsRunningProcesses_v3(void* dev, unsigned int* count, nvml::nvmlProcessInfo_t* infos) {
+	SIM_GPU_CALL(dev, g);
+	if(!count)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const auto		procs = read_procs(*g);
+	const unsigned int	n = *count;
+	*count = procs.size();
+	if(n < procs.size())
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	for(size_t i = 0; i < procs.size(); ++i) {
+		std::memset(&infos[i], 0x00, sizeof(infos[i]));
+		infos[i].pid = procs[i].pid;
+	}
+	return NVML_SUCCESS;
+}
+
+// a sample per process, at the current time
+int nvmlDeviceGetProcessUtilization(void* dev, nvml::nvmlProcessUtilizationSample_t* utilization, unsigned int* count, unsigned long long last_seen) {
+	SIM_GPU_CALL(dev, g);
+	if(!count)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const unsigned long long	ts = static_cast<unsigned long long>(g->t_s*1000000.0);
+	const auto			procs = read_procs(*g);
+	if(procs.empty() || ts <= last_seen) {
+		*count = 0;
+		return NVML_ERROR_NOT_FOUND;
+	}
+	const unsigned int	n = *count;
+	*count = procs.size();
+	if(n < procs.size() || !utilization)
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	for(size_t i = 0; i < procs.size(); ++i) {
+		std::memset(&utilization[i], 0x00, sizeof(utilization[i]));
+		utilization[i].pid = procs[i].pid;
+		utilization[i].timeStamp = ts;
+		utilization[i].smUtil = static_cast<unsigned int>(procs[i].sm_pct + 0.5);
+		utilization[i].memUtil = static_cast<unsigned int>(procs[i].mem_pct + 0.5);
+	}
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceSetPowerManagementLimit(void* dev, unsigned int limit) {
+	SIM_SET_CALL(dev, g);
+	if(limit < cfg.min_limit_w*1000.0 || limit > cfg.max_limit_w*1000.0)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	g->limit_w = limit/1000.0;
+	++g->n_sets;
+	return NVML_SUCCESS;
+}
+
+// a single memory clock, graphics clocks from the max
+// down to the idle one, highest first as NVML does
+int nvmlDeviceGetSupportedMemoryClocks(void* dev, unsigned int* count, unsigned int* clocks) {
+	SIM_GPU_CALL(dev, g);
+	if(!count)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(*count < 1 || !clocks) {
+		*count = 1;
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	}
+	*count = 1;
+	clocks[0] = static_cast<unsigned int>(MEM_CLOCK_MHZ);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetSupportedGraphicsClocks(void* dev, unsigned int mem_clock, unsigned int* count, unsigned int* clocks) {
+	SIM_GPU_CALL(dev, g);
+	if(!count)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(mem_clock != static_cast<unsigned int>(MEM_CLOCK_MHZ))
+		return NVML_ERROR_NOT_FOUND;
+	const unsigned int	n = 1 + static_cast<unsigned int>((cfg.max_clock_mhz - cfg.idle_clock_mhz)/CLOCK_STEP_MHZ);
+	if(*count < n || !clocks) {
+		*count = n;
+		return NVML_ERROR_INSUFFICIENT_SIZE;
+	}
+	*count = n;
+	for(unsigned int i = 0; i < n; ++i)
+		clocks[i] = static_cast<unsigned int>(cfg.max_clock_mhz - i*CLOCK_STEP_MHZ);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceSetGpuLockedClocks(void* dev, unsigned int min_clock, unsigned int max_clock) {
+	SIM_SET_CALL(dev, g);
+	if(min_clock > max_clock)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	g->lock_mhz = max_clock;
+	++g->n_sets;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceResetGpuLockedClocks(void* dev) {
+	SIM_SET_CALL(dev, g);
+	g->lock_mhz = 0.0;
+	++g->n_sets;
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetTotalEnergyConsumption(void* dev, unsigned long long* energy) {
+	SIM_GPU_CALL(dev, g);
+	if(!energy)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(!cfg.energy)
+		return NVML_ERROR_NOT_SUPPORTED;
+	*energy = static_cast<unsigned long long>(g->energy_j*1000.0);
+	return NVML_SUCCESS;
+}
+
+int nvmlDeviceGetFieldValues(void* dev, int count, nvml::nvmlFieldValue_t* values) {
+	SIM_GPU_CALL(dev, g);
+	if(count <= 0 || !values)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	const long long	ts = static_cast<long long>(g->t_s*1000000.0);
+	for(int i = 0; i < count; ++i) {
+		auto&	v = values[i];
+		v.timestamp = ts;
+		v.latencyUsec = 0;
+		v.nvmlReturn = NVML_SUCCESS;
+		switch(v.fieldId) {
+		case nvml::FI_DEV_POWER_AVERAGE:
+			v.valueType = 1;
+			v.value.uiVal = static_cast<unsigned int>(g->pwr_w*1000.0);
+			break;
+		case nvml::FI_DEV_POWER_INSTANT: {
+			const double	p = g->pwr_w + noise(*g);
+			v.valueType = 1;
+			v.value.uiVal = (p > 0.0) ? static_cast<unsigned int>(p*1000.0) : 0;
+		} break;
+		case nvml::FI_DEV_MEMORY_TEMP:
+			// memory sits a bit above the core at
+			// idle and a bit below at load
+			v.valueType = 1;
+			v.value.uiVal = static_cast<unsigned int>(0.8*g->temp_c + 12.0 + 0.5);
+			break;
+		case nvml::FI_DEV_TOTAL_ENERGY_CONSUMPTION:
+			if(!cfg.energy) {
+				v.nvmlReturn = NVML_ERROR_NOT_SUPPORTED;
+				break;
+			}
+			v.valueType = 3;
+			v.value.ullVal = static_cast<unsigned long long>(g->energy_j*1000.0);
+			break;
+		default:
+			v.nvmlReturn = NVML_ERROR_NOT_SUPPORTED;
+			break;
+		}
+	}
+	return NVML_SUCCESS;
+}
+
+const char* nvmlErrorString(int result) {
+	switch(result) {
+	case NVML_SUCCESS:
+		return "Success";
+	case NVML_ERROR_UNINITIALIZED:
+		return "Uninitialized";
+	case NVML_ERROR_INVALID_ARGUMENT:
+		return "Invalid Argument";
+	case NVML_ERROR_NOT_SUPPORTED:
+		return "Not Supported";
+	case NVML_ERROR_NO_PERMISSION:
+		return "Insufficient Permissions";
+	case NVML_ERROR_NOT_FOUND:
+		return "Not Found";
+	case NVML_ERROR_INSUFFICIENT_SIZE:
+		return "Insufficient Size";
+	case NVML_ERROR_FUNCTION_NOT_FOUND:
+		return "Function Not Found";
+	default:
+		break;
+	}
+	return "Unknown Error";
+}
+
+// not part of NVML: from the first invocation the simulated
+// time stops following the wall clock and only moves
+// forward by 's' seconds at each call (i.e. benchmarks
+// running scenarios faster than real time)
+int nvsimAdvance(double s) {
+	if(!init)
+		return NVML_ERROR_UNINITIALIZED;
+	if(s < 0.0)
+		return NVML_ERROR_INVALID_ARGUMENT;
+	if(manual_s < 0.0)
+		manual_s = sim_now();
+	manual_s += s;
+	return NVML_SUCCESS;
+}
+
+}
+
+#undef	SIM_GPU_CALL
@@ -0,0 +1,146 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "prof.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+	int get_value(const std::string& v, const int min_v, const int max_v, const std::string& where) {
+		char		*end = 0;
+		const long	n = std::strtol(v.c_str(), &end, 10);
+		if(v.empty() || *end || n < min_v || n > max_v)
+			throw std::runtime_error((where + ": invalid value '" + v + "'").c_str());
+		return n;
+	}
+}
+
+std::vector<prof::profile> prof::load(const std::string& fname) {
+	std::ifstream	istr(fname.c_str());
+	if(!istr)
+		throw std::runtime_error((std::string("Can't open profiles file '") + fname + "'").c_str());
+	std::vector<profile>	rv;
+	std::string		line;
+	size_t			n_line = 0;
+	while(std::getline(istr, line)) {
+		++n_line;
+		const std::string	where = fname + ":" + std::to_string(n_line);
+		std::istringstream	iss(line);
+		profile			p = { "", -1, -1, -1, "" };
+		if(!(iss >> p.comm) || p.comm[0] == '#')
+			continue;
+		// /proc/<pid>/comm is truncated
+		// to 15 characters
+		if(p.comm.size() > 15)
+			p.comm.resize(15);
+		std::string		kv;
+		while(iss >> kv) {
+			const size_t		eq = kv.find('=');
+			const std::string	k = kv.substr(0, eq),
+			      			v = (eq == std::string::npos) ? "" : kv.substr(eq + 1);
+			if(k == "max-fan")
+				p.max_fan_speed = get_value(v, 1, 100, where);
+			else if(k == "max-temp")
+				p.max_gpu_temp = get_value(v, 1, 100, where);
+			else if(k == "min-limit")
+				p.min_limit_pct = get_value(v, 0, 100, where);
+			else if(k == "fan-ctrl" && !v.empty())
+				p.fan_ctrl = v;
+			else
+				throw std::runtime_error((where + ": invalid setting '" + kv + "'").c_str());
+		}
+		rv.push_back(p);
+	}
+	return rv;
+}
+
+const unsigned int	prof::watcher::POLL_MS;
+
+prof::watcher::watcher(const std::vector<nvml::nvmlDevice_t>& devs, const std::vector<profile>& profs, const on_change& cb) :
+	devs_(devs), profs_(profs), cb_(cb), cur_(devs.size(), 0), procs_(64), stop_(false) {
+	if(!nvml::nvmlDeviceGetComputeRunningProcesses && !nvml::nvmlDeviceGetGraphicsRunningProcesses)
+		throw std::runtime_error("Loaded NVML can't list the processes running on GPUs, profiles are not supported");
+	th_ = std::thread(&watcher::loop, this);
+}
+
+prof::watcher::~watcher() {
+	{
+		std::lock_guard<std::mutex>	l(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+	if(th_.joinable())
+		th_.join();
+}
+
+const std::string& prof::watcher::comm(const unsigned int pid) {
+	auto	it = comms_.find(pid);
+	if(it != comms_.end())
+		return it->second;
+	std::string	c;
+	std::ifstream	istr(("/proc/" + std::to_string(pid) + "/comm").c_str());
+	std::getline(istr, c);
+	return comms_[pid] = c;
+}
+
+void prof::watcher::poll(void) {
+	std::vector<unsigned int>	all_pids;
+	for(size_t i = 0; i < devs_.size(); ++i) {
+		std::vector<unsigned int>	pids;
+		// errors only mean no profile
+		// change this round
+		if(!nvml::get_running_pids(devs_[i], procs_, pids))
+			continue;
+		const profile	*p = 0;
+		for(const auto& pr : profs_) {
+			for(const auto pid : pids) {
+				if(comm(pid) == pr.comm) {
+					p = &pr;
+					break;
+				}
+			}
+			if(p)
+				break;
+		}
+		if(p != cur_[i]) {
+			cur_[i] = p;
+			cb_(i, p);
+		}
+		all_pids.insert(all_pids.end(), pids.begin(), pids.end());
+	}
+	// forget the processes which quit, as
+	// pids get reused
+	for(auto it = comms_.begin(); it != comms_.end(); ) {
+		if(std::find(all_pids.begin(), all_pids.end(), it->first) == all_pids.end())
+			it = comms_.erase(it);
+		else
+			++it;
+	}
+}
+
+void prof::watcher::loop(void) {
+	std::unique_lock<std::mutex>	l(mtx_);
+	while(!stop_) {
+		l.unlock();
+		poll();
+		l.lock();
+		cv_.wait_for(l, std::chrono::milliseconds(POLL_MS), [this](){ return stop_; });
+	}
+}
@@ -0,0 +1,79 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include "nvml.h"
+
+namespace prof {
+	// settings to use while a process named 'comm' runs
+	// on a GPU; values not in the profile are -1 (or
+	// empty) and are taken from the command line
+	struct profile {
+		std::string	comm;
+		int		max_fan_speed,
+				max_gpu_temp,
+				min_limit_pct;
+		std::string	fan_ctrl;
+	};
+
+	// one profile per line, i.e.
+	// blender max-fan=70 max-temp=75 fan-ctrl=ppw min-limit=60
+	// earlier lines take priority
+	extern std::vector<profile> load(const std::string& fname);
+
+	// called with the device index and the profile
+	// now matching on it, null when none
+	typedef std::function<void(const size_t, const profile*)>	on_change;
+
+	// polls the processes running on each device every
+	// POLL_MS on its own thread, so that the control loops
+	// don't pay for it; process names are cached by pid
+	class watcher {
+		const std::vector<nvml::nvmlDevice_t>		devs_;
+		const std::vector<profile>&			profs_;
+		on_change					cb_;
+		std::vector<const profile*>			cur_;
+		std::vector<nvml::nvmlProcessInfo_t>		procs_;
+		std::unordered_map<unsigned int, std::string>	comms_;
+		bool						stop_;
+		std::mutex					mtx_;
+		std::condition_variable				cv_;
+		std::thread					th_;
+
+		const std::string& comm(const unsigned int pid);
+		void poll(void);
+		void loop(void);
+	public:
+		static const unsigned int	POLL_MS = 2000;
+
+		// throws when NVML can't list processes
+		watcher(const std::vector<nvml::nvmlDevice_t>& devs, const std::vector<profile>& profs, const on_change& cb);
+
+		~watcher();
+	};
+}
+
+#endif //_PROF_H_
@@ -0,0 +1,241 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "replay.h"
+#include "act.h"
+#include "filt.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	const size_t	MAX_FIELDS = 32;
+
+	enum col {
+		C_GPU = 0,
+		C_ITER,
+		C_FAN,
+		C_TEMP,
+		C_PWR,
+		C_LIMIT,
+		C_ELAPSED,
+		C_MEM_TEMP,
+		C_MAX
+	};
+
+	const char	*COL_NAMES[C_MAX] = {
+		"GPU",
+		"Iteration",
+		"Fan Speed (%)",
+		"GPU Temperature (C)",
+		"Power Usage (mW)",
+		"Power Limit (mW)",
+		"Elapsed (ms)",
+		"Memory Temperature (C)"
+	};
+
+	struct gpu_state {
+		std::unique_ptr<ctrl::throttle>	thr;
+		std::unique_ptr<act::pwr_limit>	pwr;
+		std::unique_ptr<filt::pipeline>	filt;
+		unsigned int			max_limit,
+						min_tgt_limit;
+		int				last_dir;
+		size_t				samples,
+						elapsed_ms,
+						fan_over_max_ms,
+						temp_over_max_ms,
+						pwr_over_limit_ms,
+						incs,
+						decs,
+						flips;
+		double				limit_accum,
+						capped_mj;
+		// time each constraint has been binding
+		// for, with the 'multi' fan control
+		std::map<std::string, size_t>	binding_ms;
+	};
+
+	// splits a CSV line in place, returns the number of fields
+	size_t split(char* line, char* fields[MAX_FIELDS]) {
+		size_t	n = 0;
+		char	*p = line;
+		while(n < MAX_FIELDS) {
+			fields[n++] = p;
+			if(!(p = std::strchr(p, ',')))
+				break;
+			*p++ = '\0';
+		}
+		// trim trailing new line
+		char	*e = fields[n-1] + std::strlen(fields[n-1]);
+		while(e > fields[n-1] && (e[-1] == '\n' || e[-1] == '\r'))
+			*--e = '\0';
+		return n;
+	}
+
+	const char* action_name(const ctrl::action a) {
+		switch(a) {
+		case ctrl::action::PWR_INC:
+			return "INC";
+		case ctrl::action::PWR_DEC:
+			return "DEC";
+		case ctrl::action::PWR_CNST:
+		default:
+			break;
+		}
+		return "CNST";
+	}
+}
+
+void replay::run(const std::string& fname, const replay::params& p) {
+	std::unique_ptr<FILE, int(*)(FILE*)>	f(std::fopen(fname.c_str(), "r"), std::fclose);
+	if(!f)
+		throw std::runtime_error((std::string("Can't open replay file '") + fname + "'").c_str());
+	const auto				t_start = std::chrono::steady_clock::now();
+	int					cols[C_MAX] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+	bool					has_header = false;
+	char					line[1024],
+						*fields[MAX_FIELDS];
+	std::map<unsigned int, gpu_state>	gpus;
+	size_t					lines = 0;
+
+	while(std::fgets(line, sizeof(line), f.get())) {
+		const size_t	n = split(line, fields);
+		// header, can be repeated when logs
+		// get concatenated
+		if(fields[0][0] < '0' || fields[0][0] > '9') {
+			for(int i = 0; i < C_MAX; ++i) {
+				cols[i] = -1;
+				for(size_t j = 0; j < n; ++j) {
+					if(!std::strcmp(fields[j], COL_NAMES[i])) {
+						cols[i] = j;
+						break;
+					}
+				}
+			}
+			for(int i = C_FAN; i <= C_LIMIT; ++i) {
+				if(cols[i] < 0)
+					throw std::runtime_error((std::string("Replay file '") + fname + "' is missing column '" + COL_NAMES[i] + "'").c_str());
+			}
+			if(!has_header) {
+				std::fprintf(stdout, "%sIteration,Fan Speed (%%),GPU Temperature (C),Power Usage (mW),Power Limit (mW),Recorded Power Limit (mW),Action,Elapsed (ms)\n", (cols[C_GPU] >= 0) ? "GPU," : "");
+				has_header = true;
+			}
+			continue;
+		}
+		if(!has_header)
+			throw std::runtime_error((std::string("Replay file '") + fname + "' doesn't start with a CSV header").c_str());
+		int	max_col = 0;
+		for(int i = 0; i < C_MAX; ++i)
+			if(cols[i] > max_col)
+				max_col = cols[i];
+		if(static_cast<int>(n) <= max_col)
+			continue;
+		const unsigned int	gpu_id = (cols[C_GPU] >= 0) ? std::strtoul(fields[cols[C_GPU]], 0, 10) : 0,
+		      			iter = (cols[C_ITER] >= 0) ? std::strtoul(fields[cols[C_ITER]], 0, 10) : lines,
+		      			fan_speed = std::strtoul(fields[cols[C_FAN]], 0, 10),
+					gpu_temp = std::strtoul(fields[cols[C_TEMP]], 0, 10),
+					gpu_pwr = std::strtoul(fields[cols[C_PWR]], 0, 10),
+					rec_limit = std::strtoul(fields[cols[C_LIMIT]], 0, 10),
+		      			mem_temp = (cols[C_MEM_TEMP] >= 0) ? std::strtoul(fields[cols[C_MEM_TEMP]], 0, 10) : 0;
+		// older logs have no elapsed time, in which
+		// case samples are every nominal interval
+		unsigned int		elapsed_ms = (cols[C_ELAPSED] >= 0) ? std::strtoul(fields[cols[C_ELAPSED]], 0, 10) : p.sleep_interval_ms;
+		++lines;
+
+		auto	it = gpus.find(gpu_id);
+		if(it == gpus.end()) {
+			// the first recorded limit is the max one
+			gpu_state	s;
+			s.thr.reset(ctrl::get_fan_ctrl(p.fan_ctrl, p.thr_params));
+			s.pwr.reset(new act::pwr_limit(0, rec_limit, p.min_limit_pct, p.min_write_ms));
+			if(!p.filters.empty())
+				s.filt.reset(new filt::pipeline(p.filters));
+			s.max_limit = s.min_tgt_limit = rec_limit;
+			s.last_dir = 0;
+			s.samples = s.elapsed_ms = s.fan_over_max_ms = s.temp_over_max_ms = s.pwr_over_limit_ms = s.incs = s.decs = s.flips = 0;
+			if(cols[C_ELAPSED] < 0)
+				elapsed_ms = 0;
+			s.limit_accum = s.capped_mj = 0.0;
+			it = gpus.insert(std::make_pair(gpu_id, std::move(s))).first;
+		}
+		auto&	s = it->second;
+
+		// statistics refer to the limit in place
+		// when the sample got recorded
+		++s.samples;
+		s.elapsed_ms += elapsed_ms;
+		const unsigned int	tgt_limit = s.pwr->target();
+		s.limit_accum += 1.0*tgt_limit*elapsed_ms;
+		if(fan_speed > p.thr_params.max_fan_speed)
+			s.fan_over_max_ms += elapsed_ms;
+		if(gpu_temp > p.thr_params.max_gpu_temp)
+			s.temp_over_max_ms += elapsed_ms;
+		if(gpu_pwr > tgt_limit) {
+			s.pwr_over_limit_ms += elapsed_ms;
+			s.capped_mj += 1.0*(gpu_pwr - tgt_limit)*elapsed_ms/1000.0;
+		}
+
+		float			b_fact = 1.0;
+		ctrl::throttle::data	thr_d = { fan_speed, gpu_temp, elapsed_ms, gpu_pwr, tgt_limit, s.pwr->min_limit(), s.pwr->max_limit(), 0, 0, mem_temp, 0 };
+		if(s.filt)
+			s.filt->apply(thr_d);
+		const auto		act = s.thr->check(thr_d, b_fact);
+		s.pwr->apply(act, b_fact, elapsed_ms);
+		const std::string	binding = s.thr->binding();
+		if(!binding.empty())
+			s.binding_ms[binding] += elapsed_ms;
+		if(s.pwr->target() != tgt_limit) {
+			if(act == ctrl::action::PWR_INC) ++s.incs;
+			else ++s.decs;
+			const int	dir = (act == ctrl::action::PWR_INC) ? 1 : -1;
+			if(s.last_dir && dir != s.last_dir)
+				++s.flips;
+			s.last_dir = dir;
+			if(s.pwr->target() < s.min_tgt_limit)
+				s.min_tgt_limit = s.pwr->target();
+		}
+
+		if(cols[C_GPU] >= 0)
+			std::fprintf(stdout, "%u,", gpu_id);
+		std::fprintf(stdout, "%u,%u,%u,%u,%u,%u,%s,%u\n", iter, fan_speed, gpu_temp, gpu_pwr, s.pwr->target(), rec_limit, action_name(act), elapsed_ms);
+	}
+	std::fflush(stdout);
+	const std::chrono::duration<double>	elapsed = std::chrono::steady_clock::now() - t_start;
+
+	std::cerr << "Replayed " << lines << " samples from '" << fname << "' with fan control '" << p.fan_ctrl << "' in " << elapsed.count() << "s" << std::endl;
+	for(const auto& i : gpus) {
+		const auto&	s = i.second;
+		std::cerr << "GPU[" << i.first << "] " << s.samples << " samples (" << s.elapsed_ms/1000.0 << "s)\n"
+			  << "\tPower limit: max " << s.max_limit << "mW, avg " << static_cast<unsigned int>(s.elapsed_ms ? s.limit_accum/s.elapsed_ms : s.max_limit) << "mW, min " << s.min_tgt_limit << "mW\n"
+			  << "\tPower limit changes: " << s.incs + s.decs << " (" << s.incs << " increases, " << s.decs << " decreases, " << s.flips << " direction changes)\n"
+			  << "\tPower limit writes: " << s.pwr->get_stats().issued << " issued, " << s.pwr->get_stats().suppressed << " suppressed (unchanged), "
+			  << s.pwr->get_stats().deferred << " deferred (rate limited)\n"
+			  << "\tRecorded power above limit for " << s.pwr_over_limit_ms/1000.0 << "s, estimated energy capped " << s.capped_mj/1000.0 << "J\n"
+			  << "\tRecorded fan speed above max (" << p.thr_params.max_fan_speed << "%) for " << s.fan_over_max_ms/1000.0 << "s, GPU temperature above max ("
+			  << p.thr_params.max_gpu_temp << "C) for " << s.temp_over_max_ms/1000.0 << "s" << std::endl;
+		for(const auto& b : s.binding_ms)
+			std::cerr << "\tConstraint '" << b.first << "' binding for " << b.second/1000.0 << "s" << std::endl;
+	}
+}
@@ -0,0 +1,43 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <string>
+#include <vector>
+#include "ctrl.h"
+
+namespace replay {
+	struct params {
+		std::string	fan_ctrl;
+		ctrl::params	thr_params;
+		unsigned int	min_limit_pct,
+				sleep_interval_ms,
+				min_write_ms;
+		// filt::pipeline specs
+		std::vector<std::string>	filters;
+	};
+
+	// streams the samples of a CSV file produced by '--log-csv'
+	// through the fan control algorithm, without sleeping, and
+	// prints the power limit decisions on std::cout and summary
+	// statistics per GPU on std::cerr
+	extern void run(const std::string& fname, const params& p);
+}
+
+#endif //_REPLAY_H_
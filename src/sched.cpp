@@ -0,0 +1,173 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "sched.h"
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace {
+	int	stop_efd = -1;
+
+	long long to_ns(const struct timespec& ts) {
+		return ts.tv_sec*1000000000LL + ts.tv_nsec;
+	}
+
+	struct timespec from_ns(const long long ns) {
+		struct timespec	ts = { static_cast<time_t>(ns/1000000000LL), static_cast<long>(ns%1000000000LL) };
+		return ts;
+	}
+
+	struct timespec now(void) {
+		struct timespec	ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts;
+	}
+}
+
+void sched::init_stop(void) {
+	if(stop_efd >= 0)
+		return;
+	if(-1 == (stop_efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)))
+		throw std::runtime_error((std::string("eventfd failed: ") + std::strerror(errno)).c_str());
+}
+
+void sched::request_stop(void) {
+	if(stop_efd < 0)
+		return;
+	// the event is never consumed, so that
+	// it wakes up all the timers
+	const uint64_t	v = 1;
+	if(write(stop_efd, &v, sizeof(v))) {
+	}
+}
+
+sched::timer::timer() : tfd_(-1), efd_(-1) {
+	if(-1 == (tfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)))
+		throw std::runtime_error((std::string("timerfd_create failed: ") + std::strerror(errno)).c_str());
+	if(-1 == (efd_ = epoll_create1(EPOLL_CLOEXEC))) {
+		close(tfd_);
+		throw std::runtime_error((std::string("epoll_create1 failed: ") + std::strerror(errno)).c_str());
+	}
+	struct epoll_event	ev;
+	std::memset(&ev, 0x00, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = tfd_;
+	epoll_ctl(efd_, EPOLL_CTL_ADD, tfd_, &ev);
+	if(stop_efd >= 0) {
+		ev.data.fd = stop_efd;
+		epoll_ctl(efd_, EPOLL_CTL_ADD, stop_efd, &ev);
+	}
+	deadline_ = last_ = now();
+}
+
+sched::timer::~timer() {
+	close(efd_);
+	close(tfd_);
+}
+
+bool sched::timer::wait(const unsigned int interval_ms, unsigned int& elapsed_ms) {
+	const long long	cur_ns = to_ns(now());
+	long long	next_ns = to_ns(deadline_) + interval_ms*1000000LL;
+	// if we're late (i.e. a very slow NVML call)
+	// skip the missed deadlines instead of
+	// trying to catch up
+	if(next_ns < cur_ns)
+		next_ns = cur_ns;
+	deadline_ = from_ns(next_ns);
+	struct itimerspec	its;
+	std::memset(&its, 0x00, sizeof(its));
+	// zero would disarm the timer
+	its.it_value = (next_ns == cur_ns) ? from_ns(next_ns + 1) : deadline_;
+	if(timerfd_settime(tfd_, TFD_TIMER_ABSTIME, &its, 0))
+		throw std::runtime_error((std::string("timerfd_settime failed: ") + std::strerror(errno)).c_str());
+	bool	rv = true;
+	while(true) {
+		struct epoll_event	ev;
+		const int		n = epoll_wait(efd_, &ev, 1, -1);
+		if(n < 0) {
+			// signals stopping the loop also
+			// invoke request_stop
+			if(errno == EINTR)
+				continue;
+			throw std::runtime_error((std::string("epoll_wait failed: ") + std::strerror(errno)).c_str());
+		}
+		if(n == 0)
+			continue;
+		if(ev.data.fd == tfd_) {
+			uint64_t	exp = 0;
+			if(read(tfd_, &exp, sizeof(exp))) {
+			}
+			break;
+		}
+		if(ev.data.fd == stop_efd) {
+			rv = false;
+			break;
+		}
+	}
+	const struct timespec	ts = now();
+	elapsed_ms = (to_ns(ts) - to_ns(last_) + 500000LL)/1000000LL;
+	last_ = ts;
+	return rv;
+}
+
+sched::adaptive::adaptive(const unsigned int min_ms, const unsigned int nominal_ms, const unsigned int max_ms, const unsigned int max_fan_speed, const unsigned int max_gpu_temp) :
+	min_ms_(min_ms), nominal_ms_(nominal_ms), max_ms_(max_ms), max_fan_speed_(max_fan_speed), max_gpu_temp_(max_gpu_temp),
+	cur_ms_(nominal_ms), ref_fan_(0), ref_temp_(0), ref_ms_(0), has_ref_(false), fan_rate_(0.0), temp_rate_(0.0) {
+}
+
+unsigned int sched::adaptive::next(const unsigned int fan_speed, const unsigned int gpu_temp, const unsigned int elapsed_ms) {
+	// sensors have 1 unit resolution, hence compute
+	// the rates over at least one second
+	if(!has_ref_) {
+		ref_fan_ = fan_speed;
+		ref_temp_ = gpu_temp;
+		ref_ms_ = 0;
+		has_ref_ = true;
+	} else {
+		ref_ms_ += elapsed_ms;
+		if(ref_ms_ >= 1000) {
+			fan_rate_ = 1000.0*(1.0*fan_speed - ref_fan_)/ref_ms_;
+			temp_rate_ = 1000.0*(1.0*gpu_temp - ref_temp_)/ref_ms_;
+			ref_fan_ = fan_speed;
+			ref_temp_ = gpu_temp;
+			ref_ms_ = 0;
+		}
+	}
+	const bool	close = (gpu_temp + 3 >= max_gpu_temp_) || (fan_speed + 5 >= max_fan_speed_),
+	      		fast = (std::fabs(temp_rate_) >= 1.0) || (std::fabs(fan_rate_) >= 2.0),
+			idle = (gpu_temp + 15 <= max_gpu_temp_) && (fan_speed + 20 <= max_fan_speed_) &&
+			       (std::fabs(temp_rate_) < 0.25) && (std::fabs(fan_rate_) < 0.5);
+	if(close || fast) {
+		cur_ms_ = min_ms_;
+	} else if(idle) {
+		// back off progressively
+		cur_ms_ = (cur_ms_ < nominal_ms_) ? nominal_ms_ : cur_ms_*2;
+		if(cur_ms_ > max_ms_)
+			cur_ms_ = max_ms_;
+	} else {
+		cur_ms_ = nominal_ms_;
+	}
+	return cur_ms_;
+}
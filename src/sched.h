@@ -0,0 +1,88 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <time.h>
+
+namespace sched {
+	// creates the event used to wake up all the
+	// timers when quitting, has to be invoked
+	// before any timer gets created
+	extern void init_stop(void);
+
+	// wakes up all the timers, can be invoked
+	// from a signal handler
+	extern void request_stop(void);
+
+	// absolute deadline timer: each deadline is computed
+	// from the previous one and not from when the work
+	// got done, hence the period doesn't drift
+	class timer {
+		int		tfd_,
+				efd_;
+		struct timespec	deadline_,
+				last_;
+	public:
+		timer();
+
+		~timer();
+
+		// waits for the next deadline, interval_ms after the
+		// previous one; returns false when woken up by
+		// request_stop. elapsed_ms is set to the
+		// actual time passed since the previous wake up
+		bool wait(const unsigned int interval_ms, unsigned int& elapsed_ms);
+
+		// epoll descriptor the timer waits on, to add
+		// other descriptors to
+		int epoll_fd(void) const {
+			return efd_;
+		}
+	};
+
+	// chooses the next sampling interval: fast when
+	// fan speed or temperature are close to target or
+	// changing quickly, backing off to slow intervals
+	// when the GPU is idle and well below the limits
+	class adaptive {
+		const unsigned int	min_ms_,
+		      			nominal_ms_,
+					max_ms_;
+		unsigned int		max_fan_speed_,
+					max_gpu_temp_,
+					cur_ms_,
+					ref_fan_,
+					ref_temp_,
+					ref_ms_;
+		bool			has_ref_;
+		double			fan_rate_,
+					temp_rate_;
+	public:
+		adaptive(const unsigned int min_ms, const unsigned int nominal_ms, const unsigned int max_ms, const unsigned int max_fan_speed, const unsigned int max_gpu_temp);
+
+		unsigned int next(const unsigned int fan_speed, const unsigned int gpu_temp, const unsigned int elapsed_ms);
+
+		void retarget(const unsigned int max_fan_speed, const unsigned int max_gpu_temp) {
+			max_fan_speed_ = max_fan_speed;
+			max_gpu_temp_ = max_gpu_temp;
+		}
+	};
+}
+
+#endif //_SCHED_H_
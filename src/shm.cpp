@@ -0,0 +1,156 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "shm.h"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char	*shm::SEG_NAME = "/nv-pwr-ctrl";
+
+namespace {
+	const uint32_t	SHM_MAGIC = 0x4e565043, // NVPC
+	      		SHM_VERSION = 2;
+
+	size_t seg_size(const uint32_t n_devices) {
+		return sizeof(shm::header) + 64 - sizeof(shm::header)%64 + n_devices*sizeof(shm::slot);
+	}
+
+	shm::slot* get_slots(void* mem) {
+		return reinterpret_cast<shm::slot*>(static_cast<char*>(mem) + sizeof(shm::header) + 64 - sizeof(shm::header)%64);
+	}
+
+	// pid of the process publishing on an existing
+	// segment, 0 when it's not valid
+	pid_t get_owner(const std::string& name) {
+		const int	fd = shm_open(name.c_str(), O_RDONLY|O_CLOEXEC, 0);
+		if(fd < 0)
+			return 0;
+		struct stat	st;
+		void		*mem = MAP_FAILED;
+		pid_t		pid = 0;
+		if(!fstat(fd, &st) && st.st_size >= static_cast<off_t>(sizeof(shm::header)) && MAP_FAILED != (mem = mmap(0, sizeof(shm::header), PROT_READ, MAP_SHARED, fd, 0))) {
+			const shm::header	*hdr = static_cast<const shm::header*>(mem);
+			if(hdr->magic == SHM_MAGIC)
+				pid = hdr->pid;
+			munmap(mem, sizeof(shm::header));
+		}
+		close(fd);
+		return pid;
+	}
+
+	// another instance publishing on the same segment
+	// would wipe it and then unlink it for both, a
+	// segment left by a dead one gets replaced
+	int create_seg(const std::string& name) {
+		int	fd = shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC, 0644);
+		if(fd >= 0 || errno != EEXIST)
+			return fd;
+		const pid_t	pid = get_owner(name);
+		if(pid > 0 && (!kill(pid, 0) || errno == EPERM))
+			throw std::runtime_error((std::string("Shared memory '") + name + "' is already in use by pid " + std::to_string(pid) + " (another nv-pwr-ctrl running with '--shm'?)").c_str());
+		shm_unlink(name.c_str());
+		return shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC, 0644);
+	}
+}
+
+shm::publisher::publisher(const std::string& name, const uint32_t n_devices) : name_(name), sz_(seg_size(n_devices)), mem_(MAP_FAILED), slots_(0), n_devices_(n_devices) {
+	const int	fd = create_seg(name_);
+	if(fd < 0)
+		throw std::runtime_error((std::string("shm_open '") + name_ + "' failed: " + std::strerror(errno)).c_str());
+	if(ftruncate(fd, sz_) || MAP_FAILED == (mem_ = mmap(0, sz_, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0))) {
+		const int	err = errno;
+		close(fd);
+		shm_unlink(name_.c_str());
+		throw std::runtime_error((std::string("Can't map shared memory '") + name_ + "': " + std::strerror(err)).c_str());
+	}
+	close(fd);
+	std::memset(mem_, 0x00, sz_);
+	slots_ = get_slots(mem_);
+	header	*hdr = static_cast<header*>(mem_);
+	hdr->version = SHM_VERSION;
+	hdr->n_devices = n_devices_;
+	hdr->pid = getpid();
+	// readers check the magic last
+	std::atomic_thread_fence(std::memory_order_release);
+	hdr->magic = SHM_MAGIC;
+}
+
+shm::publisher::~publisher() {
+	munmap(mem_, sz_);
+	shm_unlink(name_.c_str());
+}
+
+void shm::publisher::publish(const uint32_t idx, const sample& s) {
+	if(idx >= n_devices_)
+		return;
+	slot&		sl = slots_[idx];
+	const uint64_t	seq = sl.seq.load(std::memory_order_relaxed);
+	sl.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(&sl.s, &s, sizeof(s));
+	sl.seq.store(seq + 2, std::memory_order_release);
+}
+
+shm::reader::reader(const std::string& name) : sz_(0), mem_(MAP_FAILED), hdr_(0), slots_(0) {
+	const int	fd = shm_open(name.c_str(), O_RDONLY|O_CLOEXEC, 0);
+	if(fd < 0)
+		throw std::runtime_error((std::string("Can't open shared memory '") + name + "' (is nv-pwr-ctrl running with '--shm'?): " + std::strerror(errno)).c_str());
+	struct stat	st;
+	if(fstat(fd, &st) || st.st_size < static_cast<off_t>(seg_size(0)) || MAP_FAILED == (mem_ = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0))) {
+		close(fd);
+		throw std::runtime_error((std::string("Can't map shared memory '") + name + "'").c_str());
+	}
+	close(fd);
+	sz_ = st.st_size;
+	hdr_ = static_cast<const header*>(mem_);
+	slots_ = get_slots(mem_);
+	if(hdr_->magic != SHM_MAGIC || hdr_->version != SHM_VERSION || seg_size(hdr_->n_devices) > sz_) {
+		munmap(mem_, sz_);
+		throw std::runtime_error((std::string("Shared memory '") + name + "' has an invalid or unsupported layout").c_str());
+	}
+}
+
+shm::reader::~reader() {
+	munmap(mem_, sz_);
+}
+
+bool shm::reader::read(const uint32_t idx, sample& s) const {
+	if(idx >= hdr_->n_devices)
+		return false;
+	const slot&	sl = slots_[idx];
+	// writes take a few ns, the limit is only
+	// there in case the controller died mid-write
+	for(int i = 0; i < 100000; ++i) {
+		const uint64_t	seq = sl.seq.load(std::memory_order_acquire);
+		if(!seq)
+			return false;
+		// being written, retry
+		if(seq & 1)
+			continue;
+		std::memcpy(&s, &sl.s, sizeof(s));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(seq == sl.seq.load(std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,111 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+namespace shm {
+	// default POSIX shared memory segment name
+	extern const char	*SEG_NAME;
+
+	// latest sample of a device, as published
+	// by the controller; action is a ctrl::action,
+	// energy_mj and saved_mj are session totals
+	// (see energy::meter)
+	struct sample {
+		uint64_t	iter,
+				time_ns,
+				energy_mj,
+				saved_mj;
+		uint32_t	gpu,
+				fan_speed,
+				gpu_temp,
+				gpu_pwr,
+				mem_temp,
+				has_mem_temp,
+				elapsed_ms,
+				pwr_limit,
+				min_pwr_limit,
+				max_pwr_limit;
+		int32_t		action;
+		float		bump_factor;
+		char		name[64];
+	};
+
+	// segment layout: a header followed by a slot per
+	// device. Each slot is protected by a sequence lock,
+	// odd while being written, so readers never block
+	// the controller and don't need any syscall
+	struct header {
+		uint32_t	magic,
+				version,
+				n_devices,
+				pid;
+	};
+
+	struct slot {
+		std::atomic<uint64_t>	seq;
+		char			pad[56];
+		sample			s;
+	};
+
+	// creates the segment, removed on destruction
+	class publisher {
+		const std::string	name_;
+		size_t			sz_;
+		void			*mem_;
+		slot			*slots_;
+		uint32_t		n_devices_;
+	public:
+		publisher(const std::string& name, const uint32_t n_devices);
+
+		~publisher();
+
+		// to be invoked by one thread per idx
+		void publish(const uint32_t idx, const sample& s);
+	};
+
+	// maps an existing segment read only
+	class reader {
+		size_t			sz_;
+		void			*mem_;
+		const header		*hdr_;
+		const slot		*slots_;
+	public:
+		reader(const std::string& name);
+
+		~reader();
+
+		uint32_t n_devices(void) const {
+			return hdr_->n_devices;
+		}
+
+		uint32_t pid(void) const {
+			return hdr_->pid;
+		}
+
+		// returns false when no sample has
+		// been published yet
+		bool read(const uint32_t idx, sample& s) const;
+	};
+}
+
+#endif //_SHM_H_
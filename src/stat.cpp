@@ -0,0 +1,160 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+// nv-pwr-stat: prints the latest samples nv-pwr-ctrl publishes
+// with '--shm', without touching NVML at all
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <vector>
+#include <stdexcept>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include "shm.h"
+
+namespace {
+	namespace opt {
+		unsigned int	interval_ms = 0;
+		bool		log_csv = false;
+		std::string	name = shm::SEG_NAME;
+	}
+
+	void print_help(const char *prog) {
+		std::cerr <<	"Usage: " << prog << " [options]\n"
+				"Prints the latest samples nv-pwr-ctrl publishes in shared memory (see its '--shm' option)\n\n"
+				"-i, --interval i    Keeps printing every 'i' ms, default is to print once and exit\n"
+				"-l, --log-csv       Prints CSV instead of a human readable summary\n"
+				"    --shm-name n    Reads shared memory segment 'n', default is '" << opt::name << "'\n"
+				"    --help          Prints this help and exit\n\n"
+		<< std::flush;
+	}
+
+	int parse_args(int argc, char *argv[], const char *prog) {
+		int			c;
+		static struct option	long_options[] = {
+			{"interval",	required_argument, 0,	'i'},
+			{"log-csv",	no_argument,       0,	'l'},
+			{"shm-name",	required_argument, 0,	0},
+			{"help",	no_argument,	   0,	0},
+			{0, 0, 0, 0}
+		};
+
+		while (1) {
+			int		option_index = 0;
+
+			if(-1 == (c = getopt_long(argc, argv, "i:l", long_options, &option_index)))
+				break;
+
+			switch (c) {
+			case 0: {
+				if(!std::strcmp("help", long_options[option_index].name)) {
+					print_help(prog);
+					std::exit(0);
+				} else if (!std::strcmp("shm-name", long_options[option_index].name)) {
+					opt::name = optarg;
+				}
+			} break;
+
+			case 'i': {
+				const int	i_ms = std::atoi(optarg);
+				if(i_ms > 0)
+					opt::interval_ms = i_ms;
+			} break;
+
+			case 'l': {
+				opt::log_csv = true;
+			} break;
+
+			case '?': {
+				return -1;
+			} break;
+
+			default:
+				throw std::runtime_error((std::string("Invalid option '") + (char)c + "'").c_str());
+			}
+		}
+		return optind;
+	}
+
+	const char* action_name(const int32_t a) {
+		// same values as ctrl::action
+		switch(a) {
+		case 0:
+			return "INC";
+		case 1:
+			return "DEC";
+		default:
+			break;
+		}
+		return "CNST";
+	}
+
+	void print(const shm::sample& s) {
+		if(opt::log_csv) {
+			std::printf("%u,%llu,%llu,%u,%u,%u,%u,", s.gpu, static_cast<unsigned long long>(s.time_ns/1000000), static_cast<unsigned long long>(s.iter), s.fan_speed, s.gpu_temp, s.gpu_pwr, s.pwr_limit);
+			if(s.has_mem_temp)
+				std::printf("%u", s.mem_temp);
+			std::printf(",%u,%s,%.2f,%.1f,%.1f\n", s.elapsed_ms, action_name(s.action), s.bump_factor, s.energy_mj/1000.0, s.saved_mj/1000.0);
+		} else {
+			std::printf("GPU[%u] \"%s\" iter %llu: fan %u%%, temp %uC", s.gpu, s.name, static_cast<unsigned long long>(s.iter), s.fan_speed, s.gpu_temp);
+			if(s.has_mem_temp)
+				std::printf(", mem temp %uC", s.mem_temp);
+			std::printf(", power %u/%umW (limits %u-%umW), energy %.1fJ (saved ~%.1fJ), last action %s (x%.2f)\n", s.gpu_pwr, s.pwr_limit, s.min_pwr_limit, s.max_pwr_limit,
+				    s.energy_mj/1000.0, s.saved_mj/1000.0, action_name(s.action), s.bump_factor);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	try {
+		if(parse_args(argc, argv, argv[0]) < 0)
+			return -1;
+		shm::reader	rd(opt::name);
+		if(kill(rd.pid(), 0) && errno == ESRCH)
+			std::cerr << "Warning: nv-pwr-ctrl (pid " << rd.pid() << ") isn't running, samples are stale" << std::endl;
+		if(opt::log_csv)
+			std::printf("GPU,Time (ms),Iteration,Fan Speed (%%),GPU Temperature (C),Power Usage (mW),Power Limit (mW),Memory Temperature (C),Elapsed (ms),Action,Bump Factor,Energy (J),Saved Energy (J)\n");
+		std::vector<uint64_t>	last_iter(rd.n_devices(), static_cast<uint64_t>(-1));
+		while(true) {
+			for(uint32_t i = 0; i < rd.n_devices(); ++i) {
+				shm::sample	s;
+				if(!rd.read(i, s))
+					continue;
+				// when looping only print new samples
+				if(opt::interval_ms && s.iter == last_iter[i])
+					continue;
+				last_iter[i] = s.iter;
+				print(s);
+			}
+			std::fflush(stdout);
+			if(!opt::interval_ms)
+				break;
+			usleep(opt::interval_ms*1000);
+		}
+	} catch(const std::exception& e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		return -1;
+	} catch(...) {
+		std::cerr << "Unknown exception" << std::endl;
+		return -2;
+	}
+}
@@ -0,0 +1,97 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "state.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+	// profiles are a single token in the file
+	const char	*NO_PROFILE = "-";
+
+	const std::string& to_file(const std::string& profile) {
+		static const std::string	none(NO_PROFILE);
+		return profile.empty() ? none : profile;
+	}
+}
+
+int state::ambient_bucket(const unsigned int gpu_temp) {
+	return (gpu_temp + 2)/5*5;
+}
+
+void state::store::load(const std::string& fname) {
+	std::ifstream	istr(fname.c_str());
+	std::string	line;
+	std::lock_guard<std::mutex>	l(mtx_);
+	while(std::getline(istr, line)) {
+		// uuid profile fan_ctrl ambient limit [throttle state]
+		std::istringstream	iss(line);
+		entry			e;
+		if(line.empty() || line[0] == '#' || !(iss >> e.uuid >> e.profile >> e.fan_ctrl >> e.ambient_c >> e.limit_mw))
+			continue;
+		if(e.profile == NO_PROFILE)
+			e.profile.clear();
+		std::getline(iss >> std::ws, e.thr);
+		entries_.push_back(e);
+	}
+}
+
+void state::store::save(const std::string& fname) {
+	const std::string	tmp = fname + ".tmp";
+	{
+		std::ofstream			ostr(tmp.c_str());
+		std::lock_guard<std::mutex>	l(mtx_);
+		ostr << "# nv-pwr-ctrl state: uuid profile fan_ctrl ambient_c limit_mw [fan_ctrl state]\n";
+		for(const auto& e : entries_)
+			ostr << e.uuid << " " << to_file(e.profile) << " " << e.fan_ctrl << " " << e.ambient_c << " " << e.limit_mw << " " << e.thr << "\n";
+		ostr.flush();
+		if(!ostr)
+			throw std::runtime_error((std::string("Can't write state file '") + tmp + "'").c_str());
+	}
+	if(std::rename(tmp.c_str(), fname.c_str()))
+		throw std::runtime_error((std::string("Can't rename state file '") + tmp + "' to '" + fname + "'").c_str());
+}
+
+bool state::store::find(const std::string& uuid, const std::string& profile, const std::string& fan_ctrl, const unsigned int gpu_temp, entry& e) {
+	const int			amb = ambient_bucket(gpu_temp);
+	const entry			*best = 0;
+	std::lock_guard<std::mutex>	l(mtx_);
+	for(const auto& i : entries_) {
+		if(i.uuid != uuid || i.profile != profile || i.fan_ctrl != fan_ctrl)
+			continue;
+		if(!best || std::abs(i.ambient_c - amb) < std::abs(best->ambient_c - amb))
+			best = &i;
+	}
+	if(!best)
+		return false;
+	e = *best;
+	return true;
+}
+
+void state::store::put(const entry& e) {
+	std::lock_guard<std::mutex>	l(mtx_);
+	for(auto& i : entries_) {
+		if(i.uuid == e.uuid && i.profile == e.profile && i.fan_ctrl == e.fan_ctrl && i.ambient_c == e.ambient_c) {
+			i = e;
+			return;
+		}
+	}
+	entries_.push_back(e);
+}
@@ -0,0 +1,65 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace state {
+	// what a session learnt on a GPU, for a given profile
+	// and fan control algorithm, at a given ambient
+	// temperature (approximated by the lowest GPU
+	// temperature seen, in buckets of 5C)
+	struct entry {
+		std::string	uuid,
+				profile,
+				fan_ctrl;
+		int		ambient_c;
+		unsigned int	limit_mw;
+		// ctrl::throttle::save
+		std::string	thr;
+	};
+
+	extern int ambient_bucket(const unsigned int gpu_temp);
+
+	// text file with one entry per line, read at start
+	// and written at exit; device threads look up and
+	// update entries in memory
+	class store {
+		std::mutex		mtx_;
+		std::vector<entry>	entries_;
+	public:
+		// a missing file is an empty store
+		void load(const std::string& fname);
+
+		// writes a temporary file renamed over fname,
+		// hence a crash never leaves it truncated
+		void save(const std::string& fname);
+
+		// the entry with the closest ambient for uuid,
+		// profile and fan_ctrl
+		bool find(const std::string& uuid, const std::string& profile, const std::string& fan_ctrl, const unsigned int gpu_temp, entry& e);
+
+		// replaces the entry with the same key
+		void put(const entry& e);
+	};
+}
+
+#endif //_STATE_H_
@@ -0,0 +1,300 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#include "tlog.h"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+// binary log format: a header with magic, version and
+// flags, then a record per sample. Each record starts
+// with a byte telling which fields differ from the
+// previous sample of the same GPU (or, for the iteration,
+// differ from +1) and only those follow, as zigzag varint
+// deltas; the memory temperature is stored +1, with 0
+// meaning not available. Most samples take 2-4 bytes
+namespace {
+	const char	BIN_MAGIC[4] = { 'N', 'V', 'P', 'L' };
+	const uint8_t	BIN_VERSION = 1,
+	      		BIN_MULTI_GPU = 0x01;
+	const size_t	RING_SZ = 4096,
+	      		MAX_BATCH = 64*1024;
+
+	enum bin_field {
+		B_GPU = 0x01,
+		B_ITER = 0x02,
+		B_FAN = 0x04,
+		B_TEMP = 0x08,
+		B_PWR = 0x10,
+		B_LIMIT = 0x20,
+		B_MEM = 0x40,
+		B_ELAPSED = 0x80
+	};
+
+	const char	*CSV_HEADER = "Iteration,Fan Speed (%),GPU Temperature (C),Power Usage (mW),Power Limit (mW),Memory Temperature (C),Elapsed (ms)\n";
+
+	size_t pow2(const size_t n) {
+		size_t	sz = 1;
+		while(sz < n)
+			sz <<= 1;
+		return sz;
+	}
+
+	void put_varint(std::string& out, uint64_t v) {
+		while(v >= 0x80) {
+			out += static_cast<char>((v & 0x7F) | 0x80);
+			v >>= 7;
+		}
+		out += static_cast<char>(v);
+	}
+
+	void put_delta(std::string& out, const int64_t d) {
+		put_varint(out, (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63));
+	}
+
+	bool get_varint(FILE* f, uint64_t& v) {
+		v = 0;
+		for(int shift = 0; shift < 64; shift += 7) {
+			const int	c = std::getc(f);
+			if(c == EOF)
+				return false;
+			v |= static_cast<uint64_t>(c & 0x7F) << shift;
+			if(!(c & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool get_delta(FILE* f, int64_t& d) {
+		uint64_t	v;
+		if(!get_varint(f, v))
+			return false;
+		d = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+		return true;
+	}
+
+	void format_csv(std::string& out, const tlog::record& r, const bool multi_gpu) {
+		char	buf[128];
+		int	n = 0;
+		if(multi_gpu)
+			n += std::snprintf(buf, sizeof(buf), "%u,", r.gpu);
+		n += std::snprintf(buf + n, sizeof(buf) - n, "%llu,%u,%u,%u,%u,", static_cast<unsigned long long>(r.iter), r.fan_speed, r.gpu_temp, r.gpu_pwr, r.pwr_limit);
+		if(r.has_mem_temp)
+			n += std::snprintf(buf + n, sizeof(buf) - n, "%u", r.mem_temp);
+		n += std::snprintf(buf + n, sizeof(buf) - n, ",%u\n", r.elapsed_ms);
+		out.append(buf, n);
+	}
+
+	// previous sample of each GPU, to compute deltas against
+	tlog::record& prev_record(std::vector<tlog::record>& prev, const uint32_t gpu) {
+		if(gpu >= prev.size()) {
+			tlog::record	r;
+			std::memset(&r, 0, sizeof(r));
+			r.iter = static_cast<uint64_t>(-1);
+			prev.resize(gpu + 1, r);
+		}
+		return prev[gpu];
+	}
+
+	void encode(std::string& out, std::vector<tlog::record>& prev, uint32_t& prev_gpu, const tlog::record& r) {
+		tlog::record&	p = prev_record(prev, r.gpu);
+		const uint32_t	mem = r.has_mem_temp ? r.mem_temp + 1 : 0,
+		      		p_mem = p.has_mem_temp ? p.mem_temp + 1 : 0;
+		uint8_t		mask = 0;
+		if(r.gpu != prev_gpu) mask |= B_GPU;
+		if(r.iter != p.iter + 1) mask |= B_ITER;
+		if(r.fan_speed != p.fan_speed) mask |= B_FAN;
+		if(r.gpu_temp != p.gpu_temp) mask |= B_TEMP;
+		if(r.gpu_pwr != p.gpu_pwr) mask |= B_PWR;
+		if(r.pwr_limit != p.pwr_limit) mask |= B_LIMIT;
+		if(mem != p_mem) mask |= B_MEM;
+		if(r.elapsed_ms != p.elapsed_ms) mask |= B_ELAPSED;
+		out += static_cast<char>(mask);
+		if(mask & B_GPU) put_varint(out, r.gpu);
+		if(mask & B_ITER) put_delta(out, static_cast<int64_t>(r.iter - (p.iter + 1)));
+		if(mask & B_FAN) put_delta(out, static_cast<int64_t>(r.fan_speed) - p.fan_speed);
+		if(mask & B_TEMP) put_delta(out, static_cast<int64_t>(r.gpu_temp) - p.gpu_temp);
+		if(mask & B_PWR) put_delta(out, static_cast<int64_t>(r.gpu_pwr) - p.gpu_pwr);
+		if(mask & B_LIMIT) put_delta(out, static_cast<int64_t>(r.pwr_limit) - p.pwr_limit);
+		if(mask & B_MEM) put_delta(out, static_cast<int64_t>(mem) - p_mem);
+		if(mask & B_ELAPSED) put_delta(out, static_cast<int64_t>(r.elapsed_ms) - p.elapsed_ms);
+		p = r;
+		prev_gpu = r.gpu;
+	}
+
+	// returns false at the end of the file, a record
+	// truncated when the process got killed is ignored
+	bool decode(FILE* f, std::vector<tlog::record>& prev, uint32_t& prev_gpu, tlog::record& r) {
+		const int	mask = std::getc(f);
+		if(mask == EOF)
+			return false;
+		uint32_t	gpu = prev_gpu;
+		if(mask & B_GPU) {
+			uint64_t	v;
+			if(!get_varint(f, v))
+				return false;
+			gpu = static_cast<uint32_t>(v);
+		}
+		tlog::record&	p = prev_record(prev, gpu);
+		int64_t		d[7] = { 0, 0, 0, 0, 0, 0, 0 };
+		for(int i = 0; i < 7; ++i) {
+			if((mask & (B_ITER << i)) && !get_delta(f, d[i]))
+				return false;
+		}
+		const uint32_t	p_mem = p.has_mem_temp ? p.mem_temp + 1 : 0,
+		      		mem = static_cast<uint32_t>(p_mem + d[5]);
+		r.gpu = gpu;
+		r.iter = p.iter + 1 + d[0];
+		r.fan_speed = static_cast<uint32_t>(p.fan_speed + d[1]);
+		r.gpu_temp = static_cast<uint32_t>(p.gpu_temp + d[2]);
+		r.gpu_pwr = static_cast<uint32_t>(p.gpu_pwr + d[3]);
+		r.pwr_limit = static_cast<uint32_t>(p.pwr_limit + d[4]);
+		r.has_mem_temp = mem > 0;
+		r.mem_temp = mem ? mem - 1 : 0;
+		r.elapsed_ms = static_cast<uint32_t>(p.elapsed_ms + d[6]);
+		p = r;
+		prev_gpu = gpu;
+		return true;
+	}
+}
+
+tlog::ring::ring(const size_t capacity) : buf_(), mask_(pow2(capacity) - 1), head_(0), tail_(0) {
+	buf_.resize(mask_ + 1);
+}
+
+bool tlog::ring::push(const record& r) {
+	const size_t	h = head_.load(std::memory_order_relaxed);
+	if(h - tail_.load(std::memory_order_acquire) > mask_)
+		return false;
+	buf_[h & mask_] = r;
+	head_.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+bool tlog::ring::pop(record& r) {
+	const size_t	t = tail_.load(std::memory_order_relaxed);
+	if(t == head_.load(std::memory_order_acquire))
+		return false;
+	r = buf_[t & mask_];
+	tail_.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+tlog::writer::writer(FILE* csv_out, FILE* bin_out, const bool multi_gpu, const size_t n_rings) : csv_out_(csv_out), bin_out_(bin_out), multi_gpu_(multi_gpu),
+	bin_prev_gpu_(0), dropped_(0), stop_(false) {
+	for(size_t i = 0; i < n_rings; ++i)
+		rings_.emplace_back(new ring(RING_SZ));
+	csv_buf_.reserve(MAX_BATCH*2);
+	bin_buf_.reserve(MAX_BATCH*2);
+	if(csv_out_) {
+		if(multi_gpu_)
+			csv_buf_ += "GPU,";
+		csv_buf_ += CSV_HEADER;
+	}
+	if(bin_out_) {
+		bin_buf_.append(BIN_MAGIC, sizeof(BIN_MAGIC));
+		bin_buf_ += static_cast<char>(BIN_VERSION);
+		bin_buf_ += static_cast<char>(multi_gpu_ ? BIN_MULTI_GPU : 0);
+	}
+	flush();
+	th_ = std::thread(&writer::loop, this);
+}
+
+tlog::writer::~writer() {
+	stop();
+}
+
+size_t tlog::writer::drain(void) {
+	size_t	n = 0;
+	record	r;
+	for(auto& i : rings_) {
+		while(i->pop(r)) {
+			if(csv_out_)
+				format_csv(csv_buf_, r, multi_gpu_);
+			if(bin_out_)
+				encode(bin_buf_, bin_prev_, bin_prev_gpu_, r);
+			if(csv_buf_.size() >= MAX_BATCH || bin_buf_.size() >= MAX_BATCH)
+				flush();
+			++n;
+		}
+	}
+	return n;
+}
+
+void tlog::writer::flush(void) {
+	if(csv_out_ && !csv_buf_.empty()) {
+		std::fwrite(csv_buf_.data(), 1, csv_buf_.size(), csv_out_);
+		std::fflush(csv_out_);
+		csv_buf_.clear();
+	}
+	if(bin_out_ && !bin_buf_.empty()) {
+		std::fwrite(bin_buf_.data(), 1, bin_buf_.size(), bin_out_);
+		std::fflush(bin_out_);
+		bin_buf_.clear();
+	}
+}
+
+void tlog::writer::loop(void) {
+	// samples are written in batches every 100ms,
+	// which is a few samples at the fastest rate
+	while(true) {
+		if(drain())
+			flush();
+		std::unique_lock<std::mutex>	l(mtx_);
+		if(stop_)
+			break;
+		cv_.wait_for(l, std::chrono::milliseconds(100), [this](){ return stop_; });
+	}
+	drain();
+	flush();
+}
+
+void tlog::writer::stop(void) {
+	{
+		std::lock_guard<std::mutex>	l(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+	if(th_.joinable())
+		th_.join();
+}
+
+void tlog::to_csv(const std::string& fname) {
+	std::unique_ptr<FILE, int(*)(FILE*)>	f(std::fopen(fname.c_str(), "rb"), std::fclose);
+	if(!f)
+		throw std::runtime_error((std::string("Can't open binary log '") + fname + "'").c_str());
+	char	hdr[sizeof(BIN_MAGIC) + 2];
+	if(sizeof(hdr) != std::fread(hdr, 1, sizeof(hdr), f.get()) || std::memcmp(hdr, BIN_MAGIC, sizeof(BIN_MAGIC)))
+		throw std::runtime_error((std::string("File '") + fname + "' is not a binary log").c_str());
+	if(hdr[sizeof(BIN_MAGIC)] != BIN_VERSION)
+		throw std::runtime_error((std::string("Binary log '") + fname + "' has an unsupported version").c_str());
+	const bool			multi_gpu = hdr[sizeof(BIN_MAGIC) + 1] & BIN_MULTI_GPU;
+	std::vector<record>		prev;
+	uint32_t			prev_gpu = 0;
+	record				r;
+	std::string			out(multi_gpu ? "GPU," : "");
+	out += CSV_HEADER;
+	while(decode(f.get(), prev, prev_gpu, r)) {
+		format_csv(out, r, multi_gpu);
+		if(out.size() >= MAX_BATCH) {
+			std::fwrite(out.data(), 1, out.size(), stdout);
+			out.clear();
+		}
+	}
+	std::fwrite(out.data(), 1, out.size(), stdout);
+	std::fflush(stdout);
+}
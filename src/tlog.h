@@ -0,0 +1,115 @@
+/*
+    This file is part of nv-pwr-ctrl.
+
+    nv-pwr-ctrl is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    nv-pwr-ctrl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nv-pwr-ctrl.  If not, see <https://www.gnu.org/licenses/>.
+ * */
+
+#ifndef _TLOG_H_
+#define _TLOG_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdio>
+#include <stdint.h>
+
+namespace tlog {
+	// one telemetry sample, as logged by '--log-csv'
+	struct record {
+		uint64_t	iter;
+		uint32_t	gpu,
+				fan_speed,
+				gpu_temp,
+				gpu_pwr,
+				pwr_limit,
+				mem_temp,
+				elapsed_ms;
+		bool		has_mem_temp;
+	};
+
+	// single producer, single consumer ring buffer
+	// of preallocated records, never blocks
+	class ring {
+		std::vector<record>	buf_;
+		const size_t		mask_;
+		// keep producer and consumer indexes
+		// on different cache lines
+		std::atomic<size_t>	head_;
+		char			pad_[64];
+		std::atomic<size_t>	tail_;
+	public:
+		// capacity is rounded up to a power of 2
+		ring(const size_t capacity);
+
+		// returns false when full
+		bool push(const record& r);
+
+		bool pop(record& r);
+	};
+
+	// samples are pushed by the device threads into their
+	// own ring and a writer thread drains all of them,
+	// formatting and writing in batches: the control
+	// loops never format, write or wait on any I/O.
+	// When the output can't keep up samples get dropped
+	class writer {
+		std::vector<std::unique_ptr<ring>>	rings_;
+		FILE					*csv_out_,
+							*bin_out_;
+		const bool				multi_gpu_;
+		std::string				csv_buf_,
+							bin_buf_;
+		std::vector<record>			bin_prev_;
+		uint32_t				bin_prev_gpu_;
+		std::atomic<size_t>			dropped_;
+		std::mutex				mtx_;
+		std::condition_variable			cv_;
+		bool					stop_;
+		std::thread				th_;
+
+		size_t drain(void);
+		void flush(void);
+		void loop(void);
+	public:
+		// csv_out and/or bin_out can be null, n_rings is
+		// the number of producers (i.e. device threads)
+		writer(FILE* csv_out, FILE* bin_out, const bool multi_gpu, const size_t n_rings);
+
+		~writer();
+
+		// to be invoked from producer thread 'idx' only
+		void push(const size_t idx, const record& r) {
+			if(!rings_[idx]->push(r))
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// drains all the pending samples and
+		// joins the writer thread
+		void stop(void);
+
+		size_t dropped(void) const {
+			return dropped_.load(std::memory_order_relaxed);
+		}
+	};
+
+	// converts a binary log written with '--log-bin'
+	// to the same CSV '--log-csv' prints on std::cout
+	extern void to_csv(const std::string& fname);
+}
+
+#endif //_TLOG_H_